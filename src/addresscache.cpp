@@ -0,0 +1,99 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "addresscache.h"
+#include <functional>
+
+using namespace std;
+
+VtcBlockIndexer::AddressCache::AddressCache(size_t capacity) {
+    this->shardCapacity = (capacity + SHARD_COUNT - 1) / SHARD_COUNT;
+    if(this->shardCapacity == 0) {
+        this->shardCapacity = 1;
+    }
+    this->hitCount = 0;
+    this->missCount = 0;
+}
+
+string VtcBlockIndexer::AddressCache::makeKey(const vector<unsigned char>& script, bool testnet) {
+    // Prefix the network, since the same script encodes to a different address on testnet
+    string key(1, testnet ? 't' : 'm');
+    key.append(script.begin(), script.end());
+    return key;
+}
+
+VtcBlockIndexer::AddressCache::Shard& VtcBlockIndexer::AddressCache::shardFor(const string& key) {
+    return this->shards[std::hash<string>()(key) % SHARD_COUNT];
+}
+
+bool VtcBlockIndexer::AddressCache::get(const vector<unsigned char>& script, bool testnet, vector<string>& addresses) {
+    string key = makeKey(script, testnet);
+    Shard& shard = shardFor(key);
+
+    lock_guard<mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if(it == shard.index.end()) {
+        this->missCount++;
+        return false;
+    }
+
+    // Move the entry to the front, it's the most recently used now
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    addresses = it->second->second;
+    this->hitCount++;
+    return true;
+}
+
+void VtcBlockIndexer::AddressCache::put(const vector<unsigned char>& script, bool testnet, const vector<string>& addresses) {
+    string key = makeKey(script, testnet);
+    Shard& shard = shardFor(key);
+
+    lock_guard<mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if(it != shard.index.end()) {
+        // Another thread solved the same script in the meantime
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        return;
+    }
+
+    shard.entries.push_front(make_pair(key, addresses));
+    shard.index[key] = shard.entries.begin();
+
+    if(shard.entries.size() > this->shardCapacity) {
+        shard.index.erase(shard.entries.back().first);
+        shard.entries.pop_back();
+    }
+}
+
+uint64_t VtcBlockIndexer::AddressCache::hits() {
+    return this->hitCount;
+}
+
+uint64_t VtcBlockIndexer::AddressCache::misses() {
+    return this->missCount;
+}
+
+double VtcBlockIndexer::AddressCache::hitRate() {
+    uint64_t hits = this->hitCount;
+    uint64_t total = hits + this->missCount;
+    if(total == 0) {
+        return 0;
+    }
+    return (double)hits * 100 / total;
+}
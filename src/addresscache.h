@@ -0,0 +1,92 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef ADDRESSCACHE_H_INCLUDED
+#define ADDRESSCACHE_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+namespace VtcBlockIndexer {
+
+/**
+ * The AddressCache class keeps the encoded addresses of recently solved output
+ * scripts, so scripts that are paid to over and over (pool payouts, exchanges,
+ * the esign service) don't need to be hashed and base58/bech32 encoded again.
+ * It's bounded, evicts the least recently used entries and is safe to use from
+ * multiple threads.
+ */
+
+class AddressCache {
+public:
+    /** Constructs an AddressCache instance
+     *
+     * @param capacity Maximum number of scripts kept in the cache
+     */
+    AddressCache(size_t capacity);
+
+    /** Looks up the addresses for a script. Returns true when found.
+     *
+     * @param script The output script
+     * @param testnet Whether the addresses were encoded for testnet
+     * @param addresses Receives the cached addresses
+     */
+    bool get(const std::vector<unsigned char>& script, bool testnet, std::vector<std::string>& addresses);
+
+    /** Stores the addresses solved from a script */
+    void put(const std::vector<unsigned char>& script, bool testnet, const std::vector<std::string>& addresses);
+
+    /** Number of lookups that were served from the cache */
+    uint64_t hits();
+
+    /** Number of lookups that were not in the cache */
+    uint64_t misses();
+
+    /** Percentage of lookups served from the cache */
+    double hitRate();
+
+private:
+    typedef std::list<std::pair<std::string, std::vector<std::string>>> EntryList;
+
+    struct Shard {
+        std::mutex mutex;
+        EntryList entries;
+        std::unordered_map<std::string, EntryList::iterator> index;
+    };
+
+    static const size_t SHARD_COUNT = 16;
+
+    Shard& shardFor(const std::string& key);
+    static std::string makeKey(const std::vector<unsigned char>& script, bool testnet);
+
+    Shard shards[SHARD_COUNT];
+    size_t shardCapacity;
+    std::atomic<uint64_t> hitCount;
+    std::atomic<uint64_t> missCount;
+};
+
+}
+
+#endif // ADDRESSCACHE_H_INCLUDED
@@ -0,0 +1,47 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef ALLOCATIONCOUNTER_H_INCLUDED
+#define ALLOCATIONCOUNTER_H_INCLUDED
+
+#include <cstdint>
+
+namespace VtcBlockIndexer {
+
+/**
+ * The AllocationCounter counts heap allocations made through operator new.
+ * Counting is only compiled in when building with -DVTC_COUNT_ALLOCATIONS,
+ * otherwise enabled() is false and count() always returns zero. It is meant
+ * to measure how much the indexing path allocates per block.
+ */
+
+class AllocationCounter {
+public:
+    /** Returns true if allocations are being counted */
+    static bool enabled();
+
+    /** Returns the number of allocations made since the process started */
+    static uint64_t count();
+};
+
+}
+
+#endif // ALLOCATIONCOUNTER_H_INCLUDED
@@ -0,0 +1,62 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "batchlookup.h"
+#include <algorithm>
+#include <memory>
+
+using namespace std;
+
+void VtcBlockIndexer::BatchLookup::get(leveldb::DB* db, const leveldb::ReadOptions& readOptions, const vector<string>& keys, vector<bool>& found, vector<string>& values) {
+    found.assign(keys.size(), false);
+    values.assign(keys.size(), "");
+
+    if(keys.size() < iteratorThreshold) {
+        for(size_t i = 0; i < keys.size(); i++) {
+            found[i] = db->Get(readOptions, keys[i], &values[i]).ok();
+        }
+        return;
+    }
+
+    vector<size_t> order(keys.size());
+    for(size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&keys](size_t a, size_t b) {
+        return keys[a] < keys[b];
+    });
+
+    unique_ptr<leveldb::Iterator> it(db->NewIterator(readOptions));
+    for(size_t i = 0; i < order.size(); i++) {
+        const string& key = keys[order[i]];
+
+        // The iterator is at the first key at or after the previous (smaller)
+        // key. If that's at or after this key too, there's no need to seek.
+        if(!it->Valid() || it->key().compare(key) < 0) {
+            it->Seek(key);
+        }
+        if(!it->Valid()) {
+            break;
+        }
+        if(it->key().compare(key) == 0) {
+            found[order[i]] = true;
+            values[order[i]] = it->value().ToString();
+        }
+    }
+}
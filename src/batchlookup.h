@@ -0,0 +1,56 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef BATCHLOOKUP_H_INCLUDED
+#define BATCHLOOKUP_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include "leveldb/db.h"
+
+namespace VtcBlockIndexer {
+
+/**
+ * The BatchLookup class resolves many keys at once. Large sets are sorted
+ * and resolved in a single forward pass of one iterator, which visits each
+ * table block once instead of doing a full lookup per key. Small sets are
+ * plain point reads.
+ */
+
+class BatchLookup {
+public:
+    /** Looks up the passed keys
+     *
+     * @param db The database to read from
+     * @param readOptions Options (snapshot) to read with
+     * @param keys The keys to look up, duplicates are allowed
+     * @param found Set to true for every key that exists, in the order of keys
+     * @param values Receives the values of the keys that exist, in the order of keys
+     */
+    static void get(leveldb::DB* db, const leveldb::ReadOptions& readOptions, const std::vector<std::string>& keys, std::vector<bool>& found, std::vector<std::string>& values);
+
+    /** Below this number of keys point reads are used */
+    static const size_t iteratorThreshold = 32;
+};
+
+}
+
+#endif // BATCHLOOKUP_H_INCLUDED
@@ -110,8 +110,15 @@ struct Transaction {
     uint32_t lockTime;
 };
 
-// Describes a block
+// Describes a block. Blocks hold all their transactions and are large, so
+// they can only be moved, never copied.
 struct Block {
+    Block() = default;
+    Block(Block&&) = default;
+    Block& operator=(Block&&) = default;
+    Block(const Block&) = delete;
+    Block& operator=(const Block&) = delete;
+
     // The blk????.dat file this block is located in.
     string fileName;
 
@@ -151,22 +158,56 @@ struct Block {
     bool testnet;
 };
 
-struct EsignatureTransaction {
+// Describes a transaction recognized by one of the TransactionDetectors (eSignature, identity)
+struct DetectedTransaction {
+    // The address that funded the transaction (owner of the first input)
     string fromAddress;
+
+    // The address the transaction is addressed to
     string toAddress;
+
+    // The hash of the transaction
     string txId;
+
+    // Height and time of the block containing it. Zero for mempool transactions
     uint64_t height;
     uint32_t time;
+
+    // The data carrier script holding the payload
     vector<unsigned char> script;
 };
 
-struct IdentityTransaction {
-    string fromAddress;
-    string toAddress;
-    string txId;
+typedef DetectedTransaction EsignatureTransaction;
+typedef DetectedTransaction IdentityTransaction;
+
+// Confirmed totals of an address, maintained while indexing blocks
+struct AddressBalance {
+    // Total value in Satoshis ever received on the address
+    uint64_t received;
+
+    // Total value in Satoshis spent from the address
+    uint64_t spent;
+
+    // Number of TXOs ever received on the address
+    uint64_t txoCount;
+
+    // Number of TXOs on the address that are not spent yet
+    uint64_t unspentCount;
+};
+
+// Where a confirmed transaction is, as stored in its tx-<txid> record
+struct TransactionLocation {
+    // Height of the block the transaction is in
     uint64_t height;
-    uint32_t time;
-    vector<unsigned char> script;
+
+    // Position of the transaction within the block
+    uint64_t txIndex;
+
+    // The filename (without path) of the block file holding the transaction
+    string fileName;
+
+    // The position inside the block file where the transaction starts
+    uint64_t filePosition;
 };
 
 }
@@ -0,0 +1,203 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "blockfilecache.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Bytes read for a transaction at first, grown until the transaction fits
+const size_t initialTransactionWindow = 16384;
+
+// A transaction can't be bigger than a block
+const size_t maxTransactionWindow = 8 * 1024 * 1024;
+
+VtcBlockIndexer::BlockFileCache::OpenFile::~OpenFile() {
+    close(fd);
+}
+
+VtcBlockIndexer::BlockFileCache::BlockFileCache(string blocksDir, size_t maxOpenFiles) {
+    this->blocksDir = blocksDir;
+    this->maxOpenFiles = maxOpenFiles;
+    this->useCounter = 0;
+}
+
+shared_ptr<VtcBlockIndexer::BlockFileCache::OpenFile> VtcBlockIndexer::BlockFileCache::open(const string& fileName) {
+    lock_guard<mutex> lock(this->filesMutex);
+    auto it = this->files.find(fileName);
+    if(it != this->files.end()) {
+        it->second->lastUsed = ++this->useCounter;
+        return it->second;
+    }
+
+    int fd = ::open((this->blocksDir + "/" + fileName).c_str(), O_RDONLY);
+    if(fd < 0) {
+        cerr << "Block file " << fileName << " could not be opened: " << strerror(errno) << endl;
+        return nullptr;
+    }
+
+    if(this->files.size() >= this->maxOpenFiles) {
+        auto leastRecent = this->files.begin();
+        for(auto candidate = this->files.begin(); candidate != this->files.end(); candidate++) {
+            if(candidate->second->lastUsed < leastRecent->second->lastUsed) {
+                leastRecent = candidate;
+            }
+        }
+        // Closed once the last reader lets go of it
+        this->files.erase(leastRecent);
+    }
+
+    shared_ptr<OpenFile> file(new OpenFile{fd, ++this->useCounter});
+    this->files[fileName] = file;
+    return file;
+}
+
+int64_t VtcBlockIndexer::BlockFileCache::read(const string& fileName, uint64_t filePosition, size_t size, unsigned char* buffer) {
+    shared_ptr<OpenFile> file = open(fileName);
+    if(!file) {
+        return -1;
+    }
+
+    size_t total = 0;
+    while(total < size) {
+        ssize_t bytesRead = pread(file->fd, buffer + total, size - total, filePosition + total);
+        if(bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if(bytesRead < 0) {
+            return -1;
+        }
+        if(bytesRead == 0) {
+            break;
+        }
+        total += bytesRead;
+    }
+    return total;
+}
+
+bool VtcBlockIndexer::BlockFileCache::readRawTransaction(const string& fileName, uint64_t filePosition, vector<unsigned char>& raw) {
+    for(size_t window = initialTransactionWindow; window <= maxTransactionWindow; window *= 4) {
+        raw.resize(window);
+        int64_t bytesRead = read(fileName, filePosition, window, raw.data());
+        if(bytesRead <= 0) {
+            return false;
+        }
+
+        size_t txSize;
+        if(measureTransaction(raw.data(), bytesRead, txSize)) {
+            raw.resize(txSize);
+            return true;
+        }
+        if((size_t)bytesRead < window) {
+            // The file ends before the transaction does
+            return false;
+        }
+    }
+    return false;
+}
+
+bool VtcBlockIndexer::BlockFileCache::measureTransaction(const unsigned char* data, size_t size, size_t& txSize) {
+    size_t pos = 0;
+
+    // Skips a number of bytes, false if that runs past the data
+    auto skip = [&](uint64_t bytes) {
+        if(bytes > size - pos) {
+            return false;
+        }
+        pos += bytes;
+        return true;
+    };
+    auto readVarInt = [&](uint64_t& value) {
+        if(pos >= size) {
+            return false;
+        }
+        uint8_t prefix = data[pos++];
+        size_t length = prefix < 253 ? 0 : (prefix == 253 ? 2 : (prefix == 254 ? 4 : 8));
+        if(length == 0) {
+            value = prefix;
+            return true;
+        }
+        if(length > size - pos) {
+            return false;
+        }
+        value = 0;
+        for(size_t i = 0; i < length; i++) {
+            value |= (uint64_t)data[pos + i] << (8 * i);
+        }
+        pos += length;
+        return true;
+    };
+
+    // Version, followed by the segwit marker and flag if present
+    if(!skip(4) || size - pos < 2) {
+        return false;
+    }
+    bool segwit = (data[pos] == 0x00 && data[pos + 1] != 0x00);
+    if(segwit) {
+        pos += 2;
+    }
+
+    uint64_t inputCount;
+    if(!readVarInt(inputCount)) {
+        return false;
+    }
+    for(uint64_t input = 0; input < inputCount; input++) {
+        uint64_t scriptLength;
+        if(!skip(36) || !readVarInt(scriptLength) || !skip(scriptLength) || !skip(4)) {
+            return false;
+        }
+    }
+
+    uint64_t outputCount;
+    if(!readVarInt(outputCount)) {
+        return false;
+    }
+    for(uint64_t output = 0; output < outputCount; output++) {
+        uint64_t scriptLength;
+        if(!skip(8) || !readVarInt(scriptLength) || !skip(scriptLength)) {
+            return false;
+        }
+    }
+
+    if(segwit) {
+        for(uint64_t input = 0; input < inputCount; input++) {
+            uint64_t witnessItems;
+            if(!readVarInt(witnessItems)) {
+                return false;
+            }
+            for(uint64_t witnessItem = 0; witnessItem < witnessItems; witnessItem++) {
+                uint64_t itemLength;
+                if(!readVarInt(itemLength) || !skip(itemLength)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    // Lock time
+    if(!skip(4)) {
+        return false;
+    }
+    txSize = pos;
+    return true;
+}
@@ -0,0 +1,88 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef BLOCKFILECACHE_H_INCLUDED
+#define BLOCKFILECACHE_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+namespace VtcBlockIndexer {
+
+/**
+ * The BlockFileCache class reads byte ranges from the blk????.dat files. It
+ * keeps a number of block files open and reads them with pread, so any
+ * number of threads can read at the same time without reopening files or
+ * sharing a file position.
+ */
+
+class BlockFileCache {
+public:
+    /** Constructs a BlockFileCache
+     *
+     * @param blocksDir Directory containing the block files
+     * @param maxOpenFiles Number of block files to keep open
+     */
+    BlockFileCache(std::string blocksDir, size_t maxOpenFiles);
+
+    /** Reads up to size bytes at a position in a block file. Returns the
+     * number of bytes read, or -1 if the file can't be read.
+     */
+    int64_t read(const std::string& fileName, uint64_t filePosition, size_t size, unsigned char* buffer);
+
+    /** Reads the serialized transaction that starts at a position in a
+     * block file. Returns false if no complete transaction can be read.
+     */
+    bool readRawTransaction(const std::string& fileName, uint64_t filePosition, std::vector<unsigned char>& raw);
+
+private:
+    struct OpenFile {
+        int fd;
+
+        // Value of useCounter when the file was last read, to find the
+        // least recently used file
+        uint64_t lastUsed;
+        ~OpenFile();
+    };
+
+    /** Returns the open file, opening it and closing the least recently
+     * used one if needed. Readers keep the file open while they use it. */
+    std::shared_ptr<OpenFile> open(const std::string& fileName);
+
+    /** Determines the size of the serialized transaction at the start of
+     * the data. Returns false if the data ends before the transaction does.
+     */
+    static bool measureTransaction(const unsigned char* data, size_t size, size_t& txSize);
+
+    std::string blocksDir;
+    size_t maxOpenFiles;
+    std::mutex filesMutex;
+    std::unordered_map<std::string, std::shared_ptr<OpenFile>> files;
+    uint64_t useCounter;
+};
+
+}
+
+#endif // BLOCKFILECACHE_H_INCLUDED
@@ -30,23 +30,27 @@
 #include "blockscanner.h"
 #include "blockindexer.h"
 #include "blockreader.h"
+#include "allocationcounter.h"
 #include <chrono>
 #include <thread>
+#include <deque>
 #include <time.h>
 
 // Block reader object used for reading the contents of blocks
 VtcBlockIndexer::BlockReader blockReader("");
 
-// Block indexer object used to pass blocks and store in the index
-VtcBlockIndexer::BlockIndexer blockIndexer(nullptr, nullptr);
-
 using namespace std;
 
+// Number of block hashes kept while walking the chain, which limits how deep a reorg can be
+const size_t maxReorgDepth = 10000;
+
 // Constructor
-VtcBlockIndexer::BlockFileWatcher::BlockFileWatcher(string blocksDir, leveldb::DB* dbInstance, VtcBlockIndexer::MempoolMonitor* mempoolMonitor) {
+VtcBlockIndexer::BlockFileWatcher::BlockFileWatcher(string blocksDir, leveldb::DB* dbInstance, VtcBlockIndexer::MempoolMonitor* mempoolMonitor, VtcBlockIndexer::UtxoCache* utxoCache, VtcBlockIndexer::ChainSnapshot* chainSnapshot, VtcBlockIndexer::BlockSummaryFile* blockSummaries) {
     this->db = dbInstance;
     this->mempoolMonitor = mempoolMonitor;
-    blockIndexer = VtcBlockIndexer::BlockIndexer(this->db, this->mempoolMonitor);
+    this->utxoCache = utxoCache;
+    this->chainSnapshot = chainSnapshot;
+    this->blockIndexer.reset(new VtcBlockIndexer::BlockIndexer(this->db, this->mempoolMonitor, this->utxoCache, blockSummaries, chainSnapshot));
     blockReader = VtcBlockIndexer::BlockReader(blocksDir);
     this->blocksDir = blocksDir;
     this->maxLastModified.tv_sec = 0;
@@ -59,7 +63,12 @@ void VtcBlockIndexer::BlockFileWatcher::startWatcher() {
     DIR *dir;
     dirent *ent;
     string blockFilePrefix = "blk"; 
-    
+
+    // Roll back whatever the previous run didn't get to checkpoint
+    blockIndexer->recoverToCheckpoint();
+    blockIndexer->repairBlockSummaries();
+    this->chainSnapshot->publish();
+
     while(true) {
         bool shouldUpdate = false;
         dir = opendir(&*this->blocksDir.begin());
@@ -109,9 +118,9 @@ void VtcBlockIndexer::BlockFileWatcher::scanBlocks(string fileName) {
 
             // Check if a block with the same hash already exists. Unfortunately, I found
             // instances where a block is included in the block files more than once.
-            vector<VtcBlockIndexer::ScannedBlock> matchingBlocks = this->blocks[block.previousBlockHash];
+            const vector<VtcBlockIndexer::ScannedBlock>& matchingBlocks = this->blocks[block.previousBlockHash];
             bool blockFound = false;
-            for(VtcBlockIndexer::ScannedBlock matchingBlock : matchingBlocks) {
+            for(const VtcBlockIndexer::ScannedBlock& matchingBlock : matchingBlocks) {
                 if(matchingBlock.blockHash == block.blockHash) {
                     blockFound = true;
                 }
@@ -185,36 +194,30 @@ VtcBlockIndexer::ScannedBlock VtcBlockIndexer::BlockFileWatcher::findLongestChai
 }
 
 
-string VtcBlockIndexer::BlockFileWatcher::processNextBlock(string prevBlockHash) {
+bool VtcBlockIndexer::BlockFileWatcher::findNextBlock(string prevBlockHash, VtcBlockIndexer::ScannedBlock& nextBlock) {
     
     
-    // If there is no block present with this hash as previousBlockHash, return an empty 
-    // string signaling we're at the end of the chain.
+    // If there is no block present with this hash as previousBlockHash, return false
+    // signaling we're at the end of the chain.
     if(this->blocks.find(prevBlockHash) == this->blocks.end()) {
-        return "";
+        return false;
     }
     
     // Find the blocks that match
     vector<VtcBlockIndexer::ScannedBlock> matchingBlocks = this->blocks[prevBlockHash];
     
     if(matchingBlocks.size() > 0) {
-        VtcBlockIndexer::ScannedBlock bestBlock = matchingBlocks.at(0);
+        nextBlock = matchingBlocks.at(0);
         
         if(matchingBlocks.size() > 1) { 
-            bestBlock = findLongestChain(matchingBlocks);
+            nextBlock = findLongestChain(matchingBlocks);
         } 
-    
-        if(!blockIndexer.hasIndexedBlock(bestBlock.blockHash, this->blockHeight)) {
-            VtcBlockIndexer::Block fullBlock = blockReader.readBlock(bestBlock.fileName, bestBlock.filePosition, this->blockHeight, bestBlock.testnet, false);
-           
-            blockIndexer.indexBlock(fullBlock);
-        }
-        return bestBlock.blockHash;
+        return true;
 
     } else {
         // Somehow found an empty vector in the unordered_map. This should not happen. 
-        // But just in case, returning an empty value here.
-        return "";
+        // But just in case, returning false here.
+        return false;
     }
 }
 
@@ -231,24 +234,110 @@ void VtcBlockIndexer::BlockFileWatcher::updateIndex() {
     
     cout << "Found " << this->totalBlocks << " blocks. Constructing longest chain..." << endl;
 
+    // Walk the longest chain in the scanned headers up to the height that was indexed
+    // before. Only the most recent hashes are kept, that's as deep as a reorg can go.
+    long long indexedHeight = blockIndexer->getIndexedHeight();
+    deque<string> recentHashes;
+    VtcBlockIndexer::ScannedBlock nextBlock;
+
     // The blockchain starts with the genesis block that has a zero hash as Previous Block Hash
-    string nextBlock = "0000000000000000000000000000000000000000000000000000000000000000";
-    string processedBlock = processNextBlock(nextBlock);
+    const string genesisPreviousBlock = "0000000000000000000000000000000000000000000000000000000000000000";
+    string previousBlock = genesisPreviousBlock;
+    while(this->blockHeight <= indexedHeight && findNextBlock(previousBlock, nextBlock)) {
+        recentHashes.push_back(nextBlock.blockHash);
+        if(recentHashes.size() > maxReorgDepth) {
+            recentHashes.pop_front();
+        }
+        previousBlock = nextBlock.blockHash;
+        this->blockHeight++;
+    }
+
+    if(this->blockHeight <= indexedHeight) {
+        // The block files don't contain the chain we indexed (pruned, or still
+        // being written). Rather do nothing than roll back a valid index.
+        cout << "Block files only contain " << this->blockHeight << " blocks of the " << indexedHeight + 1 << " indexed, skipping update." << endl;
+        this->blocks.clear();
+        return;
+    }
+
+    // Find the fork point: the highest block that is both in the index and on the longest chain
+    long long lowestKnownHeight = this->blockHeight - recentHashes.size();
+    long long forkHeight = indexedHeight;
+    while(forkHeight >= lowestKnownHeight && !blockIndexer->hasIndexedBlock(recentHashes.at(forkHeight - lowestKnownHeight), forkHeight)) {
+        forkHeight--;
+    }
+    if(forkHeight < lowestKnownHeight && lowestKnownHeight > 0) {
+        cerr << "Reorg is deeper than " << maxReorgDepth << " blocks, only rolling back that far." << endl;
+        forkHeight = lowestKnownHeight - 1;
+    }
+
+    // Readers keep seeing the old chain until the new branch is at least as high
+    long long publishFromHeight = 0;
+    if(forkHeight < indexedHeight) {
+        cout << "Reorg detected, rolling back " << indexedHeight - forkHeight << " block(s) to fork point at height " << forkHeight << endl;
+        for(long long height = indexedHeight; height > forkHeight; height--) {
+            if(!blockIndexer->disconnectBlock(height)) {
+                // Indexing on top of a half rolled back chain would corrupt the index
+                cerr << "Failed to roll back block at height " << height << ", skipping update." << endl;
+                this->blocks.clear();
+                return;
+            }
+        }
+        publishFromHeight = indexedHeight;
+    }
+
+    // Apply the blocks following the fork point
+    this->blockHeight = forkHeight + 1;
+    if(forkHeight < 0) {
+        previousBlock = genesisPreviousBlock;
+    } else if(forkHeight >= lowestKnownHeight) {
+        previousBlock = recentHashes.at(forkHeight - lowestKnownHeight);
+    } else {
+        // Below the hashes kept from the scan, the index knows the block to continue from
+        previousBlock = blockIndexer->getIndexedBlockHash(forkHeight);
+        if(previousBlock.empty()) {
+            cerr << "Block at fork height " << forkHeight << " is missing from the index, skipping update." << endl;
+            this->blocks.clear();
+            return;
+        }
+    }
     double nextUpdate = 10;
-    while(processedBlock != "") {
+    uint64_t allocationsAtUpdate = VtcBlockIndexer::AllocationCounter::count();
+    uint64_t blocksSinceUpdate = 0;
+    while(findNextBlock(previousBlock, nextBlock)) {
+        if(!blockIndexer->indexBlock(blockReader.readBlock(nextBlock.fileName, nextBlock.filePosition, this->blockHeight, nextBlock.testnet, false))) {
+            // Indexing the next blocks would leave a gap, the next update continues from here
+            cerr << "Failed to index block " << nextBlock.blockHash << " at height " << this->blockHeight << ", stopping update." << endl;
+            this->blocks.clear();
+            return;
+        }
+        blocksSinceUpdate++;
+        if(this->blockHeight >= publishFromHeight) {
+            this->chainSnapshot->publish();
+        }
 
         // Show progress every 10 seconds
         double seconds = difftime(time(NULL), start);
         if(seconds >= nextUpdate) { 
             nextUpdate += 10;
-            cout << "Construction is at height " << this->blockHeight << endl;
+            cout << "Construction is at height " << this->blockHeight << " (address cache hit rate " << fixed << setprecision(1) << VtcBlockIndexer::ScriptSolver::addressCache().hitRate() << "%)" << endl;
+            if(VtcBlockIndexer::AllocationCounter::enabled()) {
+                uint64_t allocations = VtcBlockIndexer::AllocationCounter::count();
+                cout << "Heap allocations per block: " << (allocations - allocationsAtUpdate) / blocksSinceUpdate << endl;
+                allocationsAtUpdate = allocations;
+                blocksSinceUpdate = 0;
+            }
         }
         this->blockHeight++;
-        nextBlock = processedBlock;
-        processedBlock = processNextBlock(nextBlock);
+        previousBlock = nextBlock.blockHash;
     }
 
+    // Caught up with the chain, make sure the pending outputs are on disk
+    blockIndexer->writeCheckpoint();
+    this->chainSnapshot->publish();
+
     cout << "Done. Processed " << this->blockHeight << " blocks. Have a nice day." << endl;
+    cout << "Address cache: " << VtcBlockIndexer::ScriptSolver::addressCache().hits() << " hits, " << VtcBlockIndexer::ScriptSolver::addressCache().misses() << " misses" << endl;
 
     this->blocks.clear();
 }
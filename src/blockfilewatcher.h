@@ -25,10 +25,15 @@
 #include <iostream>
 #include <fstream>
 #include <unordered_map>
+#include <memory>
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
 #include "blockchaintypes.h"
 #include "mempoolmonitor.h"
+#include "utxocache.h"
+#include "chainsnapshot.h"
+#include "blocksummaryfile.h"
+#include "blockindexer.h"
 
 namespace VtcBlockIndexer {
 
@@ -41,13 +46,15 @@ class BlockFileWatcher {
 public:
     /** Constructs a BlockIndexer instance using the given block data directory
      */
-    BlockFileWatcher(std::string blocksDir, leveldb::DB* dbInstance, VtcBlockIndexer::MempoolMonitor* mempoolMonitor);
+    BlockFileWatcher(std::string blocksDir, leveldb::DB* dbInstance, VtcBlockIndexer::MempoolMonitor* mempoolMonitor, VtcBlockIndexer::UtxoCache* utxoCache, VtcBlockIndexer::ChainSnapshot* chainSnapshot, VtcBlockIndexer::BlockSummaryFile* blockSummaries);
 
     /** Starts watching the blocksdir for changes and will execute an incremental
      * indexing when files have changed */
     void startWatcher();
 
-    /** Updates the blockchain index incrementally */
+    /** Updates the blockchain index incrementally. When the longest chain
+     * forked off the indexed chain, the indexed blocks above the fork point
+     * are rolled back before the new branch is applied. */
     void updateIndex();
     
 private:
@@ -72,16 +79,20 @@ private:
     VtcBlockIndexer::ScannedBlock findLongestChain(std::vector<VtcBlockIndexer::ScannedBlock> matchingBlocks); 
    
     /** Finds the next block in line (by matching the prevBlockHash which is the
-     * key in the unordered_map). Then uses the block processor to do the indexing.
-     * Returns the hash of the block that was processed.
+     * key in the unordered_map). Returns false when the end of the chain is reached.
      * 
-     * @param prevBlockHash the hex hash of the block that was last processed that we should
-     * extend the chain onto.
+     * @param prevBlockHash the hex hash of the block that we should extend the chain onto.
+     * @param nextBlock receives the block that follows it on the longest chain.
      */     
-    std::string processNextBlock(std::string prevBlockHash);
+    bool findNextBlock(std::string prevBlockHash, VtcBlockIndexer::ScannedBlock& nextBlock);
     std::string blocksDir;
     leveldb::DB* db;
     VtcBlockIndexer::MempoolMonitor* mempoolMonitor;
+    VtcBlockIndexer::UtxoCache* utxoCache;
+    VtcBlockIndexer::ChainSnapshot* chainSnapshot;
+
+    // Passes the blocks on the longest chain to the index
+    std::unique_ptr<VtcBlockIndexer::BlockIndexer> blockIndexer;
     int totalBlocks;
     int blockHeight;
     unordered_map<string, vector<VtcBlockIndexer::ScannedBlock>> blocks;    
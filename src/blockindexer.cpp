@@ -21,12 +21,12 @@
 #include "scriptsolver.h"
 #include "blockchaintypes.h"
 #include <iostream>
-#include <sstream>
 #include "utility.h"
+#include "keybuilder.h"
 //#include "hashing.h"
 #include <memory>
-#include <iomanip>
 #include <unordered_map>
+#include <algorithm>
 
 
 using namespace std;
@@ -36,24 +36,35 @@ unordered_map<string, int> nextTxoIndex;
 
 
 
-VtcBlockIndexer::BlockIndexer::BlockIndexer(leveldb::DB* dbInstance, VtcBlockIndexer::MempoolMonitor* mempoolMonitor) {
+VtcBlockIndexer::BlockIndexer::BlockIndexer(leveldb::DB* dbInstance, VtcBlockIndexer::MempoolMonitor* mempoolMonitor, VtcBlockIndexer::UtxoCache* utxoCache, VtcBlockIndexer::BlockSummaryFile* blockSummaries, VtcBlockIndexer::ChainSnapshot* chainSnapshot) {
     this->db = dbInstance;
     this->mempoolMonitor = mempoolMonitor;
+    this->utxoCache = utxoCache;
+    this->blockSummaries = blockSummaries;
+    this->chainSnapshot = chainSnapshot;
     this->scriptSolver = VtcBlockIndexer::ScriptSolver();
+    this->workerPool.reset(new VtcBlockIndexer::WorkerPool());
+    this->detectors = VtcBlockIndexer::TransactionDetector::createDetectors(utxoCache, mempoolMonitor);
 }
 
 
 int VtcBlockIndexer::BlockIndexer::getNextTxoIndex(string prefix) {
     if(nextTxoIndex.find(prefix) == nextTxoIndex.end()) {
+        // Continue after the last used index. Disconnected blocks leave gaps
+        // in the numbering, so counting the existing entries is not enough.
         leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
         nextTxoIndex[prefix] = 1;
         string start(prefix + "-00000001");
         string limit(prefix + "-99999999");
         
-        for (it->Seek(start);
-                it->Valid() && it->key().ToString() < limit;
-                it->Next()) {
-                    nextTxoIndex[prefix]++;
+        it->Seek(limit);
+        if(it->Valid()) {
+            it->Prev();
+        } else {
+            it->SeekToLast();
+        }
+        if(it->Valid() && it->key().ToString() >= start && it->key().ToString() < limit) {
+            nextTxoIndex[prefix] = stoi(it->key().ToString().substr(prefix.size() + 1)) + 1;
         }
         assert(it->status().ok());  // Check for any errors found during the scan
         delete it;
@@ -64,42 +75,280 @@ int VtcBlockIndexer::BlockIndexer::getNextTxoIndex(string prefix) {
     return nextTxoIndex[prefix];
 }
 
-bool VtcBlockIndexer::BlockIndexer::clearBlockTxos(string blockHash) {
-    leveldb::WriteBatch batch;
-    
+VtcBlockIndexer::AddressBalance& VtcBlockIndexer::BlockIndexer::loadBalance(unordered_map<string, VtcBlockIndexer::AddressBalance>& balances, string address) {
+    auto it = balances.find(address);
+    if(it != balances.end()) {
+        return it->second;
+    }
+
+    string balanceValue;
+    this->db->Get(leveldb::ReadOptions(), address + "-balance", &balanceValue);
+    balances[address] = VtcBlockIndexer::Utility::decodeAddressBalance(balanceValue);
+    return balances[address];
+}
+
+void VtcBlockIndexer::BlockIndexer::writeBalances(unordered_map<string, VtcBlockIndexer::AddressBalance>& balances, leveldb::WriteBatch& batch) {
+    for(auto& kvp : balances) {
+        batch.Put(kvp.first + "-balance", VtcBlockIndexer::Utility::encodeAddressBalance(kvp.second));
+    }
+}
+
+void VtcBlockIndexer::BlockIndexer::clearBlockTxos(string blockHash, leveldb::WriteBatch& batch) {
+    unordered_map<string, VtcBlockIndexer::AddressBalance> balances;
+
+    // Restore the spent outputs before removing the block's own outputs, so an
+    // output that was created and spent within the block ends up removed
+    string spentStart(blockHash + "-txospent-00000001");
+    string spentLimit(blockHash + "-txospent-99999999");
+    leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
+    for (it->Seek(spentStart);
+            it->Valid() && it->key().ToString() < spentLimit;
+            it->Next()) {
+        // The value is the spent key ("txo-<txid>-<vout>-spent"), followed by the
+        // value and address of the spent output if it paid to an address
+        string spent = it->value().ToString();
+        batch.Delete(spent.substr(0, 83));
+        batch.Delete(it->key());
+        if(spent.size() > 99) {
+            uint64_t value = stoull(spent.substr(83,16));
+            string address = spent.substr(99);
+            VtcBlockIndexer::AddressBalance& balance = loadBalance(balances, address);
+            balance.spent -= value;
+            balance.unspentCount++;
+            string txid = spent.substr(4,64);
+            uint32_t vout = stoul(spent.substr(69,8));
+            this->utxoCache->add(txid, vout, address, value);
+
+            VtcBlockIndexer::KeyBuilder utxoValue;
+            utxoValue.appendNumber<VtcBlockIndexer::KeyWidth::Height>(getTxHeight(txid)).appendNumber<VtcBlockIndexer::KeyWidth::Value>(value);
+            batch.Put(VtcBlockIndexer::Keys::addressUtxo(address, txid, vout).slice(), utxoValue.slice());
+        }
+    }
+    assert(it->status().ok());  // Check for any errors found during the scan
+    delete it;
+
     string start(blockHash + "-txo-00000001");
     string limit(blockHash + "-txo-99999999");
-    leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
+    it = this->db->NewIterator(leveldb::ReadOptions());
     for (it->Seek(start);
             it->Valid() && it->key().ToString() < limit;
             it->Next()) {
-        batch.Delete(it->value().ToString());           
+        string txoKey = it->value().ToString();
+        string txo;
+        leveldb::Status s = this->db->Get(leveldb::ReadOptions(), txoKey, &txo);
+        if(s.ok()) {
+            // Take the output off the balance of the address it paid to ("<address>-txo-<height>-<sequence>")
+            string address = txoKey.substr(0, txoKey.size() - VtcBlockIndexer::Keys::addressTxoSuffixSize);
+            VtcBlockIndexer::AddressBalance& balance = loadBalance(balances, address);
+            balance.received -= stoull(txo.substr(80));
+            balance.txoCount--;
+            balance.unspentCount--;
+            string txid = txo.substr(0,64);
+            uint32_t vout = stoul(txo.substr(64,8));
+            this->utxoCache->remove(txid, vout, batch);
+            batch.Delete(VtcBlockIndexer::Keys::addressUtxo(address, txid, vout).slice());
+        }
+        batch.Delete(txoKey);
+        batch.Delete(it->key());
     }
     assert(it->status().ok());  // Check for any errors found during the scan
     delete it;
 
-    string spentStart(blockHash + "-txospent-00000001");
-    string spentLimit(blockHash + "-txospent-99999999");
-    it = this->db->NewIterator(leveldb::ReadOptions());
-    for (it->Seek(spentStart);
-            it->Valid() && it->key().ToString() < spentLimit;
+    writeBalances(balances, batch);
+}
+
+void VtcBlockIndexer::BlockIndexer::addCheckpoint(leveldb::WriteBatch& batch, long long height) {
+    if(!this->blockSummaries->sync()) {
+        cerr << "Failed to sync the block summary file" << endl;
+    }
+    this->utxoCache->flush(batch);
+    batch.Put("checkpoint", std::to_string(height));
+}
+
+bool VtcBlockIndexer::BlockIndexer::writeBatch(leveldb::WriteBatch& batch, bool sync) {
+    leveldb::WriteOptions writeOptions;
+    writeOptions.sync = sync;
+    leveldb::Status s = this->db->Write(writeOptions, &batch);
+    if(!s.ok()) {
+        cerr << "Failed to write to the index: " << s.ToString() << endl;
+
+        // The counters were advanced for keys that never made it to disk,
+        // read them back from the database when they're needed again
+        nextTxoIndex.clear();
+        this->utxoCache->rollback();
+        return false;
+    }
+
+    // Outputs flushed into this batch are on disk now and can leave memory
+    this->utxoCache->commit();
+    return true;
+}
+
+bool VtcBlockIndexer::BlockIndexer::writeCheckpoint() {
+    leveldb::WriteBatch batch;
+    addCheckpoint(batch, getIndexedHeight());
+    return writeBatch(batch, true);
+}
+
+long long VtcBlockIndexer::BlockIndexer::recoverToCheckpoint() {
+    long long indexedHeight = getIndexedHeight();
+    string checkpointValue;
+    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), "checkpoint", &checkpointValue);
+    if(!s.ok()) {
+        // Indexes written before checkpoints existed, trust the tip
+        return indexedHeight;
+    }
+
+    long long checkpoint = stoll(checkpointValue);
+    if(indexedHeight <= checkpoint) {
+        cout << "Index is consistent at height " << indexedHeight << endl;
+        return indexedHeight;
+    }
+
+    // The outputs created after the checkpoint may not have been flushed
+    // from the UTXO cache. Roll those blocks back, they will be indexed again.
+    cout << "Index was not shut down cleanly, rolling back from height " << indexedHeight << " to checkpoint at " << checkpoint << endl;
+    for(long long height = indexedHeight; height > checkpoint; height--) {
+        if(!disconnectBlock(height)) {
+            cerr << "Failed to roll back block at height " << height << endl;
+            break;
+        }
+    }
+    return getIndexedHeight();
+}
+
+void VtcBlockIndexer::BlockIndexer::repairBlockSummaries() {
+    long long indexedHeight = getIndexedHeight();
+    if(indexedHeight < 0) {
+        return;
+    }
+
+    // Records below the tip were written before the next block was
+    // indexed, so only the tip and anything the file doesn't have yet
+    // (like an index built before the file existed) need to be rewritten
+    uint64_t height = min(this->blockSummaries->count(), (uint64_t)indexedHeight);
+    if(height < (uint64_t)indexedHeight) {
+        cout << "Writing block summaries from height " << height << " to " << indexedHeight << endl;
+    }
+    for(; height <= (uint64_t)indexedHeight; height++) {
+        VtcBlockIndexer::BlockSummary summary;
+        if(!VtcBlockIndexer::BlockSummaryFile::readFromIndex(this->db, leveldb::ReadOptions(), height, summary) ||
+            !this->blockSummaries->write(height, summary)) {
+            cerr << "Failed to repair block summary at height " << height << endl;
+            return;
+        }
+    }
+    this->blockSummaries->sync();
+}
+
+uint64_t VtcBlockIndexer::BlockIndexer::getTxHeight(string txid) {
+    string value;
+    VtcBlockIndexer::TransactionLocation location;
+    if(!this->db->Get(leveldb::ReadOptions(), VtcBlockIndexer::Keys::tx(txid).slice(), &value).ok() ||
+        !VtcBlockIndexer::Utility::decodeTransactionLocation(value, location)) {
+        return 0;
+    }
+    return location.height;
+}
+
+long long VtcBlockIndexer::BlockIndexer::getIndexedHeight() {
+    string highestBlock;
+    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), "highestblock", &highestBlock);
+    if(!s.ok()) {
+        return -1;
+    }
+    return stoll(highestBlock);
+}
+
+bool VtcBlockIndexer::BlockIndexer::disconnectBlock(uint64_t height) {
+    VtcBlockIndexer::KeyBuilder blockKey = VtcBlockIndexer::Keys::block(height);
+
+    string blockHash;
+    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), blockKey.slice(), &blockHash);
+    if(!s.ok()) {
+        return false;
+    }
+
+    cout << "Disconnecting block " << blockHash << " at height " << height << endl;
+
+    leveldb::WriteBatch batch;
+
+    // Reverse the TXOs, spends and balances
+    clearBlockTxos(blockHash, batch);
+
+    // Remove the transactions
+    VtcBlockIndexer::KeyBuilder txsKey = VtcBlockIndexer::Keys::blockField("txs", height);
+    string packedTxids;
+    s = this->db->Get(leveldb::ReadOptions(), txsKey.slice(), &packedTxids);
+    if(s.ok()) {
+        for(const string& txHash : VtcBlockIndexer::Utility::unpackTxids(packedTxids)) {
+            batch.Delete(VtcBlockIndexer::Keys::tx(txHash).slice());
+        }
+    }
+    batch.Delete(txsKey.slice());
+
+    // Remove the esignature and identity records
+    string start = blockHash + "-esign-00000001";
+    string limit = blockHash + "-esign-99999999";
+    leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
+    for (it->Seek(start);
+            it->Valid() && it->key().ToString() < limit;
             it->Next()) {
-        batch.Delete(it->value().ToString());           
+        batch.Delete(it->value().ToString());
+        batch.Delete(it->key());
     }
     assert(it->status().ok());  // Check for any errors found during the scan
     delete it;
 
-    leveldb::Status s = this->db->Write(leveldb::WriteOptions(), &batch);
+    // Remove the block itself
+    batch.Delete(blockKey.slice());
+    batch.Delete(VtcBlockIndexer::Keys::blockField("filePosition", height).slice());
+    batch.Delete(VtcBlockIndexer::Keys::blockHash(blockHash).slice());
+    batch.Delete(VtcBlockIndexer::Keys::blockField("time", height).slice());
+    batch.Delete(VtcBlockIndexer::Keys::blockField("size", height).slice());
+    batch.Delete(VtcBlockIndexer::Keys::blockField("txcount", height).slice());
+
+    if(height > 0) {
+        batch.Put("highestblock", VtcBlockIndexer::KeyBuilder().appendNumber<VtcBlockIndexer::KeyWidth::Height>(height - 1).slice());
+    } else {
+        batch.Delete("highestblock");
+    }
+
+    // Disconnecting restores spent outputs in the UTXO cache, so checkpoint
+    // right away. Reorgs are rare, the extra flush doesn't matter.
+    addCheckpoint(batch, (long long)height - 1);
+    if(!writeBatch(batch, true)) {
+        return false;
+    }
+    this->chainSnapshot->blocksDisconnected();
+    return true;
+}
+
+bool VtcBlockIndexer::BlockIndexer::checkIndexVersion(leveldb::DB* db) {
+    string indexVersion;
+    leveldb::Status s = db->Get(leveldb::ReadOptions(), "indexversion", &indexVersion);
+    if(s.ok()) {
+        return stoi(indexVersion) == INDEX_VERSION;
+    }
+
+    // No version stamped. That's fine for an empty index, but an index that
+    // already has blocks was built with an older layout.
+    string highestBlock;
+    s = db->Get(leveldb::ReadOptions(), "highestblock", &highestBlock);
+    if(s.ok()) {
+        return false;
+    }
+    leveldb::WriteBatch batch;
+    batch.Put("indexversion", std::to_string(INDEX_VERSION));
+    batch.Put("checkpoint", "-1");
+    s = db->Write(leveldb::WriteOptions(), &batch);
     return s.ok();
 }
 
 bool VtcBlockIndexer::BlockIndexer::hasIndexedBlock(string blockHash, int blockHeight)
 {
-    stringstream ss;
-    ss << "block-" << setw(8) << setfill('0') << blockHeight;
-
     string existingBlockHash;
-    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), ss.str(), &existingBlockHash);
+    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), VtcBlockIndexer::Keys::block(blockHeight).slice(), &existingBlockHash);
     if(s.ok() && existingBlockHash == blockHash) {
         return true;
     }
@@ -107,174 +356,231 @@ bool VtcBlockIndexer::BlockIndexer::hasIndexedBlock(string blockHash, int blockH
     return false;
 }
 
-bool VtcBlockIndexer::BlockIndexer::indexBlock(Block block) {
+string VtcBlockIndexer::BlockIndexer::getIndexedBlockHash(uint64_t blockHeight) {
+    string blockHash;
+    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), VtcBlockIndexer::Keys::block(blockHeight).slice(), &blockHash);
+    if(!s.ok()) {
+        return "";
+    }
+    return blockHash;
+}
+
+bool VtcBlockIndexer::BlockIndexer::indexBlock(const Block& block) {
     this->scriptSolver.testnet = block.testnet;
+    for(const unique_ptr<VtcBlockIndexer::TransactionDetector>& detector : this->detectors) {
+        detector->setTestnet(block.testnet);
+    }
     
-    stringstream ss;
-    ss << "block-" << setw(8) << setfill('0') << block.height;
+    VtcBlockIndexer::KeyBuilder blockKey = VtcBlockIndexer::Keys::block(block.height);
 
     string existingBlockHash;
-    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), ss.str(), &existingBlockHash);
+    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), blockKey.slice(), &existingBlockHash);
 
     if(s.ok() && existingBlockHash == block.blockHash) {
         // Block found in database and matches. This block is indexed already, so skip.
         return true;
     } else if (s.ok()) {
-        // There was a different block at this height. Ditch the TXOs from the old block.
-        clearBlockTxos(existingBlockHash);
+        // There was a different block at this height. Reorgs are rolled back by
+        // the BlockFileWatcher from the tip down, never index on top of one.
+        cerr << "Block " << existingBlockHash << " is already indexed at height " << block.height << ", not indexing " << block.blockHash << endl;
+        return false;
     }
 
-    stringstream blockHeight;
-    blockHeight << setw(8) << setfill('0') << block.height;
+    VtcBlockIndexer::KeyBuilder blockHeight = VtcBlockIndexer::KeyBuilder().appendNumber<VtcBlockIndexer::KeyWidth::Height>(block.height);
 
+    // The tip moves in the same batch as the block data, so it never
+    // points at a block that's only partially written
+    leveldb::WriteBatch batch;
     string highestBlock;
     s = this->db->Get(leveldb::ReadOptions(), "highestblock", &highestBlock);
-    if(!s.ok()) {
-        this->db->Put(leveldb::WriteOptions(), "highestblock", blockHeight.str());
-    } else {
-        if(stoull(highestBlock) < block.height) {
-            this->db->Put(leveldb::WriteOptions(), "highestblock", blockHeight.str());
-        }
+    if(!s.ok() || stoull(highestBlock) < block.height) {
+        batch.Put("highestblock", blockHeight.slice());
     }
-    
-    this->db->Put(leveldb::WriteOptions(), ss.str(), block.blockHash);
-    
-    stringstream ssBlockFilePositionKey;
-    ssBlockFilePositionKey << "block-filePosition-" << setw(8) << setfill('0') << block.height;
-    stringstream ssBlockFilePositionValue;
-    ssBlockFilePositionValue << block.fileName << setw(12) << setfill('0') << block.filePosition << (block.testnet ? 1 : 0);
 
-    this->db->Put(leveldb::WriteOptions(), ssBlockFilePositionKey.str(), ssBlockFilePositionValue.str());
-    
-    stringstream ssBlockHashHeightKey;
-    ssBlockHashHeightKey << "block-hash-" << block.blockHash;
-    stringstream ssBlockHashHeightValue;
-    ssBlockHashHeightValue << setw(8) << setfill('0') << block.height;
+    batch.Put(blockKey.slice(), block.blockHash);
 
-    this->db->Put(leveldb::WriteOptions(), ssBlockHashHeightKey.str(), ssBlockHashHeightValue.str());
-    
-    stringstream ssBlockTimeHeightKey;
-    ssBlockTimeHeightKey << "block-time-" << setw(8) << setfill('0') << block.height;
-    this->db->Put(leveldb::WriteOptions(), ssBlockTimeHeightKey.str(), std::to_string(block.time));
-    
-    stringstream ssBlockSizeHeightKey;
-    ssBlockSizeHeightKey << "block-size-" << setw(8) << setfill('0') << block.height;
-    this->db->Put(leveldb::WriteOptions(), ssBlockSizeHeightKey.str(), std::to_string(block.byteSize));
-    
-    stringstream ssBlockTxCountHeightKey;
-    ssBlockTxCountHeightKey << "block-txcount-"  << setw(8) << setfill('0') << block.height;
-    this->db->Put(leveldb::WriteOptions(), ssBlockTxCountHeightKey.str(), std::to_string(block.transactions.size()));
+    VtcBlockIndexer::KeyBuilder blockFilePosition;
+    blockFilePosition.append(block.fileName).appendNumber<VtcBlockIndexer::KeyWidth::FilePosition>(block.filePosition).append(block.testnet ? "1" : "0", 1);
+    batch.Put(VtcBlockIndexer::Keys::blockField("filePosition", block.height).slice(), blockFilePosition.slice());
+    batch.Put(VtcBlockIndexer::Keys::blockHash(block.blockHash).slice(), blockHeight.slice());
+    batch.Put(VtcBlockIndexer::Keys::blockField("time", block.height).slice(), VtcBlockIndexer::KeyBuilder().appendNumber<0>(block.time).slice());
+    batch.Put(VtcBlockIndexer::Keys::blockField("size", block.height).slice(), VtcBlockIndexer::KeyBuilder().appendNumber<0>(block.byteSize).slice());
+    batch.Put(VtcBlockIndexer::Keys::blockField("txcount", block.height).slice(), VtcBlockIndexer::KeyBuilder().appendNumber<0>(block.transactions.size()).slice());
+    batch.Put(VtcBlockIndexer::Keys::blockField("txs", block.height).slice(), VtcBlockIndexer::Utility::packTxids(block.transactions));
 
-    int txIndex = -1;
     // TODO: Verify block integrity
 
-    indexSignatureTransactions(block);
-    indexIdentityTransactions(block);
-    
-    for(VtcBlockIndexer::Transaction tx : block.transactions) {
-        
-
+    // Compute phase: solving the output scripts (hashing and address encoding)
+    // does not depend on any shared state, so it's spread over the worker pool.
+    // Everything that needs a counter or touches the UTXO cache is left for
+    // the commit phase below.
+    size_t outputCount = 0;
+    for(const VtcBlockIndexer::Transaction& tx : block.transactions) {
+        outputCount += tx.outputs.size();
+    }
+    vector<pair<size_t, size_t>> outputRefs;
+    outputRefs.reserve(outputCount);
+    vector<size_t> firstOutputRef;
+    firstOutputRef.reserve(block.transactions.size());
+    for(size_t txIdx = 0; txIdx < block.transactions.size(); txIdx++) {
+        firstOutputRef.push_back(outputRefs.size());
+        for(size_t outIdx = 0; outIdx < block.transactions.at(txIdx).outputs.size(); outIdx++) {
+            outputRefs.push_back(make_pair(txIdx, outIdx));
+        }
+    }
 
-        txIndex++;
-        stringstream blockTxKey;
-        blockTxKey << "block-" << block.blockHash << "-tx-" << setw(8) << setfill('0') << txIndex;
-        this->db->Put(leveldb::WriteOptions(), blockTxKey.str(), tx.txHash);
+    vector<IndexedOutput> indexedOutputs(outputRefs.size());
+    unordered_map<string, VtcBlockIndexer::AddressBalance> balances;
+    unordered_map<string, uint32_t> addressSequences;
+    vector<string> detectedAddresses;
+    this->workerPool->parallelFor(outputRefs.size(), 64, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            const VtcBlockIndexer::Transaction& tx = block.transactions.at(outputRefs.at(i).first);
+            const VtcBlockIndexer::TransactionOutput& out = tx.outputs.at(outputRefs.at(i).second);
+            IndexedOutput& indexed = indexedOutputs.at(i);
+
+            indexed.addresses = this->scriptSolver.getAddressesFromScript(out.script);
+            if(indexed.addresses.empty()) {
+                continue;
+            }
 
-        stringstream ssTxFilePositionKey;
-        ssTxFilePositionKey << "tx-filePosition-" << tx.txHash;
-        stringstream ssTxFilePositionValue;
-        ssTxFilePositionValue << block.fileName << setw(12) << setfill('0') << tx.filePosition;
-    
-        this->db->Put(leveldb::WriteOptions(), ssTxFilePositionKey.str(), ssTxFilePositionValue.str());
-
-        stringstream txBlockKey;
-        txBlockKey << "tx-" << tx.txHash << "-block";
-        this->db->Put(leveldb::WriteOptions(), txBlockKey.str(), block.blockHash);
-
-
-        for(VtcBlockIndexer::TransactionOutput out : tx.outputs) {
-            vector<string> addresses = this->scriptSolver.getAddressesFromScript(out.script);
-            for(string address : addresses) {
-                int nextIndex = getNextTxoIndex(address + "-txo");
-                stringstream txoKey;
-                txoKey << address << "-txo-" << setw(8) << setfill('0') << nextIndex;
-                stringstream txoValue;
-                txoValue << tx.txHash << setw(8) << setfill('0') << out.index << setw(8) << setfill('0') << block.height << out.value;
-                this->db->Put(leveldb::WriteOptions(), txoKey.str(), txoValue.str());
-
-                stringstream txoAddrKey;
-                txoAddrKey << tx.txHash << setw(8) << setfill('0') << out.index;
-                this->db->Put(leveldb::WriteOptions(), txoAddrKey.str(), address);
-                
-
-                nextIndex = getNextTxoIndex(block.blockHash + "-txo");
-                stringstream blockTxoKey;
-                blockTxoKey << block.blockHash << "-txo-" << setw(8) << setfill('0') << nextIndex;
-                this->db->Put(leveldb::WriteOptions(), blockTxoKey.str(), txoKey.str());
+            VtcBlockIndexer::KeyBuilder txoValue;
+            txoValue.append(tx.txHash).appendNumber<VtcBlockIndexer::KeyWidth::Index>(out.index).appendNumber<VtcBlockIndexer::KeyWidth::Height>(block.height).appendNumber<0>(out.value);
+            indexed.txoValue = txoValue.str();
+        }
+    });
+
+    // Commit phase: assign the TXO counters in block order and collect
+    // all writes in the batch
+    for(size_t txIdx = 0; txIdx < block.transactions.size(); txIdx++) {
+        const VtcBlockIndexer::Transaction& tx = block.transactions.at(txIdx);
+
+        // Detect eSignature and identity transactions before the inputs are
+        // spent from the UTXO cache, the detectors need the funding address
+        indexDetectedTransactions(tx, block, batch, detectedAddresses);
+
+        VtcBlockIndexer::TransactionLocation location = {block.height, txIdx, block.fileName, tx.filePosition};
+        batch.Put(VtcBlockIndexer::Keys::tx(tx.txHash).slice(), VtcBlockIndexer::Utility::encodeTransactionLocation(location));
+
+        for(size_t outIdx = 0; outIdx < tx.outputs.size(); outIdx++) {
+            const IndexedOutput& indexed = indexedOutputs.at(firstOutputRef.at(txIdx) + outIdx);
+            for(const string& address : indexed.addresses) {
+                // Address history is keyed by height, the sequence only
+                // orders the outputs to the same address within this block
+                uint32_t sequence = ++addressSequences[address];
+                VtcBlockIndexer::KeyBuilder txoKey = VtcBlockIndexer::Keys::addressTxo(address, block.height, sequence);
+                batch.Put(txoKey.slice(), indexed.txoValue);
+
+                // The txid+vout -> address record is written when the cache is flushed
+                const VtcBlockIndexer::TransactionOutput& out = tx.outputs.at(outIdx);
+                this->utxoCache->add(tx.txHash, out.index, address, out.value);
+
+                VtcBlockIndexer::AddressBalance& balance = loadBalance(balances, address);
+                balance.received += out.value;
+                balance.txoCount++;
+                balance.unspentCount++;
+
+                VtcBlockIndexer::KeyBuilder utxoValue;
+                utxoValue.appendNumber<VtcBlockIndexer::KeyWidth::Height>(block.height).appendNumber<VtcBlockIndexer::KeyWidth::Value>(out.value);
+                batch.Put(VtcBlockIndexer::Keys::addressUtxo(address, tx.txHash, out.index).slice(), utxoValue.slice());
+
+                int nextIndex = getNextTxoIndex(block.blockHash + "-txo");
+                batch.Put(VtcBlockIndexer::Keys::counted(block.blockHash, "txo", nextIndex).slice(), txoKey.slice());
             }
         }
 
-        for(VtcBlockIndexer::TransactionInput txi : tx.inputs) {
+        for(const VtcBlockIndexer::TransactionInput& txi : tx.inputs) {
             if(!txi.coinbase)
             {
-                stringstream txSpentKey;
-                txSpentKey << "txo-" << txi.txHash << "-" << setw(8) << setfill('0') << txi.txoIndex << "-spent";
-                
-                stringstream spendingTx;
-                spendingTx << block.blockHash << "-" << tx.txHash;
-                
-                this->db->Put(leveldb::WriteOptions(), txSpentKey.str(), spendingTx.str());
+                VtcBlockIndexer::KeyBuilder txSpentKey = VtcBlockIndexer::Keys::txoSpent(txi.txHash, txi.txoIndex);
+
+                VtcBlockIndexer::KeyBuilder spendingTx;
+                spendingTx.append(block.blockHash).append("-", 1).append(tx.txHash);
+
+                batch.Put(txSpentKey.slice(), spendingTx.slice());
+
+                // Keep the value and address of the spent output next to the spent
+                // key, so the balance can be restored when the block is disconnected
+                VtcBlockIndexer::KeyBuilder blockTxoSpentValue = txSpentKey;
+
+                string spentAddress;
+                uint64_t spentValue;
+                if(this->utxoCache->get(txi.txHash, txi.txoIndex, spentAddress, spentValue)) {
+                    VtcBlockIndexer::AddressBalance& balance = loadBalance(balances, spentAddress);
+                    balance.spent += spentValue;
+                    balance.unspentCount--;
+                    batch.Delete(VtcBlockIndexer::Keys::addressUtxo(spentAddress, txi.txHash, txi.txoIndex).slice());
+                    blockTxoSpentValue.appendNumber<VtcBlockIndexer::KeyWidth::Value>(spentValue).append(spentAddress);
+                }
+                this->utxoCache->spend(txi.txHash, txi.txoIndex);
 
                 int nextIndex = getNextTxoIndex(block.blockHash + "-txospent");
-                stringstream blockTxoSpentKey;
-                blockTxoSpentKey << block.blockHash << "-txospent-" << setw(8) << setfill('0') << nextIndex;
-                this->db->Put(leveldb::WriteOptions(), blockTxoSpentKey.str(), txSpentKey.str());
+                batch.Put(VtcBlockIndexer::Keys::counted(block.blockHash, "txospent", nextIndex).slice(), blockTxoSpentValue.slice());
             }
         }
-        this->mempoolMonitor->transactionIndexed(tx.txHash);
     }
 
+    writeBalances(balances, batch);
 
+    bool checkpoint = this->utxoCache->needsFlush();
+    if(checkpoint) {
+        addCheckpoint(batch, block.height);
+    }
 
-    return true;
-}
-
-void VtcBlockIndexer::BlockIndexer::indexSignatureTransactions(Block block) {
-    vector<EsignatureTransaction> esignTransactions = VtcBlockIndexer::Utility::parseEsignatureTransactions(block, this->db, &this->scriptSolver, this->mempoolMonitor);
-    for(VtcBlockIndexer::EsignatureTransaction tx : esignTransactions) {
-
-        cout << "Found eSign transaction!" << endl;
-        int nextIndex = getNextTxoIndex("esign-out-" + tx.fromAddress);
-        stringstream esignOutKey;
-        esignOutKey << "esign-out-" << tx.fromAddress << "-" << setw(8) << setfill('0') << nextIndex;
-        stringstream esignOutValue;
-        esignOutValue << tx.toAddress << tx.txId << setw(12) << setfill('0') << block.height << setw(12) << setfill('0') << block.time << VtcBlockIndexer::Utility::hashToHex(tx.script);
-        this->db->Put(leveldb::WriteOptions(), esignOutKey.str(), esignOutValue.str());
-        
-        nextIndex = getNextTxoIndex("esign-in-" + tx.toAddress);
-        stringstream esignInKey;
-        esignInKey << "esign-in-" << tx.toAddress << "-" << setw(8) << setfill('0') << nextIndex;
-        stringstream esignInValue;
-        esignInValue << tx.fromAddress << tx.txId << setw(12) << setfill('0') << block.height << setw(12) << setfill('0') << block.time << VtcBlockIndexer::Utility::hashToHex(tx.script);
-        this->db->Put(leveldb::WriteOptions(), esignInKey.str(), esignInValue.str());
-        
+    if(!writeBatch(batch, checkpoint)) {
+        cerr << "Failed to write block " << block.blockHash << endl;
+        return false;
     }
-}
 
-void VtcBlockIndexer::BlockIndexer::indexIdentityTransactions(Block block) {
-    vector<IdentityTransaction> identityTransactions = VtcBlockIndexer::Utility::parseIdentityTransactions(block, this->db, &this->scriptSolver, this->mempoolMonitor);
-    for(VtcBlockIndexer::IdentityTransaction tx : identityTransactions) {
+    // The block's own counters are done, only the address counters are used again
+    nextTxoIndex.erase(block.blockHash + "-txo");
+    nextTxoIndex.erase(block.blockHash + "-txospent");
+    nextTxoIndex.erase(block.blockHash + "-esign");
 
-        cout << "Found identity transaction!" << endl;
+    // The summary is rewritten at startup when the process is killed
+    // before it's written, the index stays leading
+    this->blockSummaries->write(block);
 
-        int nextIndex = getNextTxoIndex("ident-" + tx.toAddress);
-        stringstream identKey;
-        identKey << "ident-" << tx.toAddress << "-" << setw(8) << setfill('0') << nextIndex;
-        stringstream identValue;
-        identValue << tx.fromAddress << tx.txId << setw(12) << setfill('0') << block.height << setw(12) << setfill('0') << block.time << VtcBlockIndexer::Utility::hashToHex(tx.script);
-        this->db->Put(leveldb::WriteOptions(), identKey.str(), identValue.str());
-        
+    // Every address that received or spent an output has its balance updated
+    for(const auto& kvp : balances) {
+        this->chainSnapshot->addressChanged(kvp.first);
+    }
+    for(const string& address : detectedAddresses) {
+        this->chainSnapshot->addressChanged(address);
+    }
+
+    for(const VtcBlockIndexer::Transaction& tx : block.transactions) {
+        this->chainSnapshot->transactionIndexed(tx.txHash);
     }
+
+    return true;
 }
 
+void VtcBlockIndexer::BlockIndexer::indexDetectedTransactions(const VtcBlockIndexer::Transaction& tx, const VtcBlockIndexer::Block& block, leveldb::WriteBatch& batch, vector<string>& changedAddresses) {
+    for(const unique_ptr<VtcBlockIndexer::TransactionDetector>& detector : this->detectors) {
+        VtcBlockIndexer::DetectedTransaction match;
+        if(!detector->detect(tx, match)) {
+            continue;
+        }
 
+        cout << "Found " << detector->name() << " transaction!" << endl;
+        changedAddresses.push_back(match.fromAddress);
+        changedAddresses.push_back(match.toAddress);
+        for(const pair<string, string>& entry : detector->indexEntries(match)) {
+            int nextIndex = getNextTxoIndex(entry.first);
+            VtcBlockIndexer::KeyBuilder key = VtcBlockIndexer::Keys::counted(entry.first, nextIndex);
+            VtcBlockIndexer::KeyBuilder value;
+            value.append(entry.second).append(match.txId)
+                .appendNumber<VtcBlockIndexer::KeyWidth::EsignHeight>(block.height)
+                .appendNumber<VtcBlockIndexer::KeyWidth::Timestamp>(block.time)
+                .appendHex(match.script.data(), match.script.size());
+            batch.Put(key.slice(), value.slice());
+            addBlockEsignRecord(block.blockHash, key.str(), batch);
+        }
+    }
+}
+
+void VtcBlockIndexer::BlockIndexer::addBlockEsignRecord(string blockHash, string key, leveldb::WriteBatch& batch) {
+    int nextIndex = getNextTxoIndex(blockHash + "-esign");
+    batch.Put(VtcBlockIndexer::Keys::counted(blockHash, "esign", nextIndex).slice(), key);
+}
@@ -24,11 +24,18 @@
 
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <unordered_map>
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
 #include "blockchaintypes.h"
 #include "scriptsolver.h"
 #include "mempoolmonitor.h"
+#include "workerpool.h"
+#include "utxocache.h"
+#include "transactiondetector.h"
+#include "blocksummaryfile.h"
+#include "chainsnapshot.h"
 
 namespace VtcBlockIndexer {
 
@@ -43,11 +50,12 @@ class BlockIndexer {
 public:
     /** Constructs a BlockIndexer instance using the given block data directory
      */
-    BlockIndexer(leveldb::DB* dbInstance, VtcBlockIndexer::MempoolMonitor* mempoolMonitor);
+    BlockIndexer(leveldb::DB* dbInstance, VtcBlockIndexer::MempoolMonitor* mempoolMonitor, VtcBlockIndexer::UtxoCache* utxoCache, VtcBlockIndexer::BlockSummaryFile* blockSummaries, VtcBlockIndexer::ChainSnapshot* chainSnapshot);
 
-    /** Indexes the contents of the block
+    /** Indexes the contents of the block. Returns false when the block
+     * couldn't be written or a different block is indexed at its height.
      */
-    bool indexBlock(Block block);
+    bool indexBlock(const Block& block);
 
     /** Returns true when there's already a block with the passed hash
      * in the index at the passed blockheight. No need to reindex
@@ -55,22 +63,116 @@ public:
      */
     bool hasIndexedBlock(std::string blockHash, int blockHeight);
 
-    void indexSignatureTransactions(Block block);
-    void indexIdentityTransactions(Block block);
+    /** Returns the hash of the block indexed at the passed height, or an
+     * empty string when there is none
+     */
+    std::string getIndexedBlockHash(uint64_t blockHeight);
+
+    /** Returns the height of the highest indexed block, or -1 when the
+     * index is empty
+     */
+    long long getIndexedHeight();
+
+    /** Removes the block at the passed height from the index using the undo
+     * records written while indexing it. Blocks have to be disconnected from
+     * the tip downwards.
+     */
+    bool disconnectBlock(uint64_t height);
+
+    /** Writes the pending outputs of the UTXO cache and marks the current
+     * tip as checkpoint, in one synced batch
+     */
+    bool writeCheckpoint();
+
+    /** Called at startup. When the index is ahead of its last checkpoint the
+     * process was killed before the UTXO cache was flushed, so the blocks
+     * after the checkpoint are disconnected to be indexed again. Otherwise
+     * the index is trusted as is. Returns the indexed height.
+     */
+    long long recoverToCheckpoint();
+
+    /** Called at startup, after recoverToCheckpoint. Rewrites the block
+     * summary records the file is missing, and the one of the tip, which may
+     * not have been written when the process was killed.
+     */
+    void repairBlockSummaries();
+
+    /** Returns true when the index on disk uses the current layout (or is
+     * empty, in which case it's stamped with the current version)
+     */
+    static bool checkIndexVersion(leveldb::DB* db);
+
+    /** Version of the index layout. Bump when existing indexes can no longer
+     * be read and need to be rebuilt.
+     */
+    static const int INDEX_VERSION = 5;
 private:
-    /** Removes TXOs and spends from a particular blockhash 
-     * in case of a reorg */
+    /** Holds the results of solving a single output script during the
+     * (parallel) compute phase of indexBlock
+     */
+    struct IndexedOutput {
+        // The addresses the output pays to
+        std::vector<std::string> addresses;
+
+        // Value of the address TXO record (txid, vout, height, value)
+        std::string txoValue;
+    };
+
+    /** Adds the removal of the TXOs and spends from a particular blockhash
+     * to the batch, in case of a reorg */
+
+    void clearBlockTxos(std::string blockHash, leveldb::WriteBatch& batch);
+
+    /** Flushes the UTXO cache into the batch and sets the checkpoint (the
+     * height up to which everything is on disk) in the same batch. Syncs
+     * the block summary file first, so it's on disk up to the checkpoint too.
+     */
+    void addCheckpoint(leveldb::WriteBatch& batch, long long height);
+
+    /** Writes a batch to the database. Resets the in-memory counters if
+     * that fails.
+     */
+    bool writeBatch(leveldb::WriteBatch& batch, bool sync);
+
+    /** Returns the balance record of an address, reading it from the
+     * database if it's not in the passed map yet */
+    VtcBlockIndexer::AddressBalance& loadBalance(std::unordered_map<std::string, VtcBlockIndexer::AddressBalance>& balances, std::string address);
+
+    /** Adds the updated balance records to the batch */
+    void writeBalances(std::unordered_map<std::string, VtcBlockIndexer::AddressBalance>& balances, leveldb::WriteBatch& batch);
+
+    /** Records that an esignature or identity key belongs to the block,
+     * so it can be removed when the block is disconnected
+     */
+    void addBlockEsignRecord(std::string blockHash, std::string key, leveldb::WriteBatch& batch);
+
+    /** Runs the transaction detectors on a transaction and adds the index
+     * entries for every match to the batch. The addresses involved are added
+     * to changedAddresses, to be marked once the batch is written.
+     */
+    void indexDetectedTransactions(const VtcBlockIndexer::Transaction& tx, const VtcBlockIndexer::Block& block, leveldb::WriteBatch& batch, std::vector<std::string>& changedAddresses);
+
+    /** Returns the height of the block containing a transaction */
+    uint64_t getTxHeight(std::string txid);
 
-    bool clearBlockTxos(std::string blockHash);
     /** Returns the next index to use for storing the TXO
      */
     int getNextTxoIndex(std::string prefix);
 
     leveldb::DB* db;
     VtcBlockIndexer::MempoolMonitor* mempoolMonitor;
+    VtcBlockIndexer::UtxoCache* utxoCache;
+    VtcBlockIndexer::BlockSummaryFile* blockSummaries;
+    VtcBlockIndexer::ChainSnapshot* chainSnapshot;
 
     // Reference to the scriptsolver class
     VtcBlockIndexer::ScriptSolver scriptSolver;
+
+    // Worker threads used to solve output scripts in parallel
+    std::unique_ptr<VtcBlockIndexer::WorkerPool> workerPool;
+
+    // Detectors for eSignature and identity transactions
+    std::vector<std::unique_ptr<VtcBlockIndexer::TransactionDetector>> detectors;
 };
 
 }
@@ -29,9 +29,14 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <algorithm>
 
 using namespace std;
 
+// Upper bound for preallocating from counts read from the file, so a
+// corrupt count can't make us reserve gigabytes up front
+const uint64_t maxReserve = 65536;
+
 VtcBlockIndexer::BlockReader::BlockReader(const string blocksDir) {
     
     this->blocksDir = blocksDir;
@@ -84,10 +89,10 @@ VtcBlockIndexer::Block VtcBlockIndexer::BlockReader::readBlock(string fileName,
         blockFile.seekg(filePosition+80, ios_base::beg);
         uint64_t txCount = VtcBlockIndexer::FileReader::readVarInt(blockFile);
         
-        fullBlock.transactions = {};
+        fullBlock.transactions.clear();
+        fullBlock.transactions.reserve(min(txCount, maxReserve));
         for(uint64_t tx = 0; tx < txCount; tx++) {
-            VtcBlockIndexer::Transaction transaction = readTransaction(blockFile);
-            fullBlock.transactions.push_back(transaction);
+            fullBlock.transactions.push_back(readTransaction(blockFile));
         }
     }
     uint64_t endPosBlock = blockFile.tellg();
@@ -117,9 +122,8 @@ VtcBlockIndexer::Transaction VtcBlockIndexer::BlockReader::readTransaction(istre
     
     uint64_t startPosInputs = blockFile.tellg();
 
-    transaction.inputs = {};
-
     uint64_t inputCount = VtcBlockIndexer::FileReader::readVarInt(blockFile);
+    transaction.inputs.reserve(min(inputCount, maxReserve));
     
     for(uint64_t input = 0; input < inputCount; input++) {
         VtcBlockIndexer::TransactionInput txInput;
@@ -129,17 +133,17 @@ VtcBlockIndexer::Transaction VtcBlockIndexer::BlockReader::readTransaction(istre
         blockFile.read(reinterpret_cast<char *>(&txInput.sequence), sizeof(txInput.sequence));
         txInput.index = input;
         txInput.coinbase = (input == 0 && txInput.txHash == "0000000000000000000000000000000000000000000000000000000000000000" && txInput.txoIndex == 4294967295);
-        transaction.inputs.push_back(txInput);
+        transaction.inputs.push_back(std::move(txInput));
     }
     
     uint64_t outputCount = VtcBlockIndexer::FileReader::readVarInt(blockFile);
-    transaction.outputs = {};
+    transaction.outputs.reserve(min(outputCount, maxReserve));
     for(uint64_t output = 0; output < outputCount; output++) {
         VtcBlockIndexer::TransactionOutput txOutput;
         blockFile.read(reinterpret_cast<char *>(&txOutput.value), sizeof(txOutput.value));
         txOutput.script = VtcBlockIndexer::FileReader::readString(blockFile);
         txOutput.index = output;
-        transaction.outputs.push_back(txOutput);
+        transaction.outputs.push_back(std::move(txOutput));
     }
 
     uint64_t endPosOutputs = blockFile.tellg();
@@ -149,10 +153,10 @@ VtcBlockIndexer::Transaction VtcBlockIndexer::BlockReader::readTransaction(istre
         for(uint64_t input = 0; input < inputCount; input++) {
             uint64_t witnessItems = VtcBlockIndexer::FileReader::readVarInt(blockFile);
             if(witnessItems > 0) {
-                transaction.inputs.at(input).witnessData = {};
+                vector<vector<unsigned char>>& witnessData = transaction.inputs.at(input).witnessData;
+                witnessData.reserve(min(witnessItems, maxReserve));
                 for(uint64_t witnessItem = 0; witnessItem < witnessItems; witnessItem++) {
-                    vector<unsigned char> witnessData = VtcBlockIndexer::FileReader::readString(blockFile);
-                    transaction.inputs.at(input).witnessData.push_back(witnessData);
+                    witnessData.push_back(VtcBlockIndexer::FileReader::readString(blockFile));
                 }
             }
         }
@@ -189,7 +193,7 @@ VtcBlockIndexer::Transaction VtcBlockIndexer::BlockReader::readTransaction(istre
         blockFile.read(reinterpret_cast<char *>(&transactionBytes[0]) , length);
         transaction.txWitHash = VtcBlockIndexer::Utility::hashToReverseHex(VtcBlockIndexer::Utility::sha256(VtcBlockIndexer::Utility::sha256(transactionBytes)));
     } else {
-        transaction.txWitHash = string(transaction.txHash);
+        transaction.txWitHash = transaction.txHash;
     }
     blockFile.seekg(endPosTx, ios_base::beg);
 
@@ -0,0 +1,155 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "blocksummaryfile.h"
+#include "utility.h"
+#include "keybuilder.h"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+string VtcBlockIndexer::BlockSummary::blockHash() const {
+    return VtcBlockIndexer::Utility::hashToHex(vector<unsigned char>(hash, hash + sizeof(hash)));
+}
+
+string VtcBlockIndexer::BlockSummary::blockFileName() const {
+    return string(fileName, strnlen(fileName, sizeof(fileName)));
+}
+
+VtcBlockIndexer::BlockSummaryFile::Mapping::~Mapping() {
+    munmap((void*)data, size);
+}
+
+VtcBlockIndexer::BlockSummaryFile::BlockSummaryFile(string path) {
+    this->fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(this->fd < 0) {
+        // Every block write and lookup needs the file, there's no point in running without it
+        cerr << "Failed to open block summary file " << path << ": " << strerror(errno) << endl;
+        exit(1);
+    }
+}
+
+VtcBlockIndexer::BlockSummaryFile::~BlockSummaryFile() {
+    this->mapping.reset();
+    if(this->fd >= 0) {
+        close(this->fd);
+    }
+}
+
+void VtcBlockIndexer::BlockSummaryFile::fill(VtcBlockIndexer::BlockSummary& summary, const string& blockHash, const string& fileName, uint64_t filePosition, bool testnet, uint32_t time, uint32_t size, uint32_t txCount) {
+    memset(&summary, 0, sizeof(summary));
+    vector<unsigned char> hash = VtcBlockIndexer::Utility::hexToBytes(blockHash);
+    memcpy(summary.hash, hash.data(), min(hash.size(), sizeof(summary.hash)));
+    memcpy(summary.fileName, fileName.data(), min(fileName.size(), sizeof(summary.fileName)));
+    summary.filePosition = filePosition;
+    summary.testnet = testnet ? 1 : 0;
+    summary.time = time;
+    summary.size = size;
+    summary.txCount = txCount;
+}
+
+bool VtcBlockIndexer::BlockSummaryFile::write(const VtcBlockIndexer::Block& block) {
+    VtcBlockIndexer::BlockSummary summary;
+    fill(summary, block.blockHash, block.fileName, block.filePosition, block.testnet, block.time, block.byteSize, block.transactions.size());
+    return write(block.height, summary);
+}
+
+bool VtcBlockIndexer::BlockSummaryFile::write(uint64_t height, const VtcBlockIndexer::BlockSummary& summary) {
+    ssize_t written = pwrite(this->fd, &summary, sizeof(summary), height * sizeof(summary));
+    if(written != (ssize_t)sizeof(summary)) {
+        cerr << "Failed to write block summary at height " << height << ": " << strerror(errno) << endl;
+        return false;
+    }
+    return true;
+}
+
+bool VtcBlockIndexer::BlockSummaryFile::sync() {
+    return fdatasync(this->fd) == 0;
+}
+
+uint64_t VtcBlockIndexer::BlockSummaryFile::count() {
+    struct stat fileStat;
+    if(fstat(this->fd, &fileStat) != 0) {
+        return 0;
+    }
+    return fileStat.st_size / sizeof(VtcBlockIndexer::BlockSummary);
+}
+
+shared_ptr<const VtcBlockIndexer::BlockSummaryFile::Mapping> VtcBlockIndexer::BlockSummaryFile::remap() {
+    lock_guard<mutex> lock(this->mappingMutex);
+    size_t size = count() * sizeof(VtcBlockIndexer::BlockSummary);
+    if(size == 0 || (this->mapping && this->mapping->size >= size)) {
+        return this->mapping;
+    }
+
+    // Readers may still hold the old mapping, it's unmapped once they let go
+    void* data = mmap(NULL, size, PROT_READ, MAP_SHARED, this->fd, 0);
+    if(data == MAP_FAILED) {
+        cerr << "Failed to map block summary file: " << strerror(errno) << endl;
+        return this->mapping;
+    }
+    this->mapping.reset(new Mapping{(const char*)data, size});
+    return this->mapping;
+}
+
+bool VtcBlockIndexer::BlockSummaryFile::read(uint64_t height, VtcBlockIndexer::BlockSummary& summary) {
+    size_t end = (height + 1) * sizeof(VtcBlockIndexer::BlockSummary);
+    shared_ptr<const Mapping> current;
+    {
+        lock_guard<mutex> lock(this->mappingMutex);
+        current = this->mapping;
+    }
+    if(!current || current->size < end) {
+        current = remap();
+        if(!current || current->size < end) {
+            return false;
+        }
+    }
+    memcpy(&summary, current->data + height * sizeof(VtcBlockIndexer::BlockSummary), sizeof(summary));
+
+    // Heights that were skipped read back as zeroes
+    return summary.txCount != 0;
+}
+
+bool VtcBlockIndexer::BlockSummaryFile::readFromIndex(leveldb::DB* db, const leveldb::ReadOptions& readOptions, uint64_t height, VtcBlockIndexer::BlockSummary& summary) {
+    string blockHash;
+    string filePosition;
+    string time;
+    string size;
+    string txCount;
+    if(!db->Get(readOptions, VtcBlockIndexer::Keys::block(height).slice(), &blockHash).ok() ||
+        !db->Get(readOptions, VtcBlockIndexer::Keys::blockField("filePosition", height).slice(), &filePosition).ok() ||
+        !db->Get(readOptions, VtcBlockIndexer::Keys::blockField("time", height).slice(), &time).ok() ||
+        !db->Get(readOptions, VtcBlockIndexer::Keys::blockField("size", height).slice(), &size).ok() ||
+        !db->Get(readOptions, VtcBlockIndexer::Keys::blockField("txcount", height).slice(), &txCount).ok() ||
+        filePosition.size() < 24) {
+        return false;
+    }
+    bool testnet = filePosition.size() > 24 && filePosition.at(24) == '1';
+    fill(summary, blockHash, filePosition.substr(0,12), stoull(filePosition.substr(12,12)), testnet, stoul(time), stoul(size), stoul(txCount));
+    return true;
+}
@@ -0,0 +1,127 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef BLOCKSUMMARYFILE_H_INCLUDED
+#define BLOCKSUMMARYFILE_H_INCLUDED
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include "leveldb/db.h"
+#include "blockchaintypes.h"
+
+namespace VtcBlockIndexer {
+
+/**
+ * The fixed-size record kept for every block in the block summary file. The
+ * file is a local cache of the index, so it's written in native byte order.
+ */
+struct BlockSummary {
+    // The block hash as 32 raw bytes, in the order of the hex string
+    unsigned char hash[32];
+
+    // The position where the block starts inside its block file
+    uint64_t filePosition;
+
+    // Timestamp of the block
+    uint32_t time;
+
+    // Size of the block in bytes
+    uint32_t size;
+
+    // Number of transactions in the block. Never 0 for a written record.
+    uint32_t txCount;
+
+    // The blk????.dat file the block is located in, not null terminated
+    char fileName[12];
+
+    // 1 if the block is from the testnet
+    uint8_t testnet;
+
+    uint8_t padding[7];
+
+    std::string blockHash() const;
+    std::string blockFileName() const;
+};
+
+static_assert(sizeof(BlockSummary) == 72, "BlockSummary records must keep their size on disk");
+
+/**
+ * The BlockSummaryFile class keeps a BlockSummary per height in a flat file,
+ * at offset height * sizeof(BlockSummary). The indexer writes it and the HTTP
+ * server reads it through a read-only memory mapping, so listing blocks or
+ * finding a block by height doesn't touch LevelDB.
+ * The file may run ahead of the index: records above the indexed height are
+ * left over from disconnected or uncommitted blocks and must be ignored.
+ */
+
+class BlockSummaryFile {
+public:
+    /** Opens or creates the block summary file. Exits the process when
+     * the file can't be opened.
+     *
+     * @param path Location of the file
+     */
+    BlockSummaryFile(std::string path);
+    ~BlockSummaryFile();
+
+    /** Writes the record for a block at its height */
+    bool write(const VtcBlockIndexer::Block& block);
+
+    /** Writes the record at a height */
+    bool write(uint64_t height, const VtcBlockIndexer::BlockSummary& summary);
+
+    /** Flushes the written records to disk */
+    bool sync();
+
+    /** Reads the record at a height. Returns false when it hasn't been
+     * written yet. The record may be left over from a disconnected block or
+     * torn by a concurrent write, so callers check it against the index. */
+    bool read(uint64_t height, VtcBlockIndexer::BlockSummary& summary);
+
+    /** Number of records the file has room for */
+    uint64_t count();
+
+    /** Builds the record for a height from the block keys in the index.
+     * Returns false when the block isn't indexed. */
+    static bool readFromIndex(leveldb::DB* db, const leveldb::ReadOptions& readOptions, uint64_t height, VtcBlockIndexer::BlockSummary& summary);
+
+private:
+    struct Mapping {
+        const char* data;
+        size_t size;
+        ~Mapping();
+    };
+
+    /** Returns the current mapping, replacing it first if the file grew */
+    std::shared_ptr<const Mapping> remap();
+
+    static void fill(VtcBlockIndexer::BlockSummary& summary, const std::string& blockHash, const std::string& fileName, uint64_t filePosition, bool testnet, uint32_t time, uint32_t size, uint32_t txCount);
+
+    int fd;
+    std::mutex mappingMutex;
+    std::shared_ptr<const Mapping> mapping;
+};
+
+}
+
+#endif // BLOCKSUMMARYFILE_H_INCLUDED
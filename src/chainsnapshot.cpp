@@ -0,0 +1,85 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "chainsnapshot.h"
+#include "mempoolmonitor.h"
+
+using namespace std;
+
+VtcBlockIndexer::ChainSnapshot::ChainSnapshot(leveldb::DB* dbInstance, VtcBlockIndexer::ChangeCounters* changeCounters, VtcBlockIndexer::MempoolMonitor* mempoolMonitor) {
+    this->db = dbInstance;
+    this->changeCounters = changeCounters;
+    this->mempoolMonitor = mempoolMonitor;
+    this->disconnected = false;
+    publish();
+}
+
+void VtcBlockIndexer::ChainSnapshot::publish() {
+    leveldb::DB* db = this->db;
+    shared_ptr<const leveldb::Snapshot> snapshot(db->GetSnapshot(), [db](const leveldb::Snapshot* s) {
+        db->ReleaseSnapshot(s);
+    });
+
+    vector<string> changed;
+    vector<string> indexed;
+    bool disconnected;
+    {
+        lock_guard<mutex> lock(this->currentMutex);
+        this->current = snapshot;
+        changed.swap(this->changedAddresses);
+        indexed.swap(this->indexedTransactions);
+        disconnected = this->disconnected;
+        this->disconnected = false;
+    }
+
+    // Readers of the new snapshot find these transactions in the index
+    for(const string& txid : indexed) {
+        this->mempoolMonitor->transactionIndexed(txid);
+    }
+
+    // Only now the change is visible, a reader that sees the new counter
+    // also gets the new snapshot and the pruned mempool
+    if(disconnected) {
+        this->changeCounters->allChanged();
+    }
+    for(const string& address : changed) {
+        this->changeCounters->addressChanged(address);
+    }
+    this->changeCounters->tipChanged();
+}
+
+void VtcBlockIndexer::ChainSnapshot::addressChanged(const string& address) {
+    lock_guard<mutex> lock(this->currentMutex);
+    this->changedAddresses.push_back(address);
+}
+
+void VtcBlockIndexer::ChainSnapshot::transactionIndexed(const string& txid) {
+    lock_guard<mutex> lock(this->currentMutex);
+    this->indexedTransactions.push_back(txid);
+}
+
+void VtcBlockIndexer::ChainSnapshot::blocksDisconnected() {
+    lock_guard<mutex> lock(this->currentMutex);
+    this->disconnected = true;
+}
+
+shared_ptr<const leveldb::Snapshot> VtcBlockIndexer::ChainSnapshot::acquire() {
+    lock_guard<mutex> lock(this->currentMutex);
+    return this->current;
+}
@@ -0,0 +1,86 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef CHAINSNAPSHOT_H_INCLUDED
+#define CHAINSNAPSHOT_H_INCLUDED
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <string>
+#include "leveldb/db.h"
+#include "changecounters.h"
+
+namespace VtcBlockIndexer {
+
+class MempoolMonitor;
+
+/**
+ * The ChainSnapshot class holds the database snapshot that readers (the HTTP
+ * server) should use. The indexer publishes a new snapshot whenever it has
+ * committed a block, but not while it's in the middle of a reorg, so readers
+ * see either the chain from before or after the reorg and never a mix.
+ * The addresses changed by the committed blocks are marked in the change
+ * counters, and their transactions are dropped from the mempool, when the
+ * snapshot holding the change is published.
+ */
+
+class ChainSnapshot {
+public:
+    /** Constructs a ChainSnapshot instance and publishes the current state
+     * of the database
+     */
+    ChainSnapshot(leveldb::DB* dbInstance, VtcBlockIndexer::ChangeCounters* changeCounters, VtcBlockIndexer::MempoolMonitor* mempoolMonitor);
+
+    /** Makes the current state of the database visible to readers */
+    void publish();
+
+    /** Records that a committed block changed an address, it's marked as
+     * changed on the next publish */
+    void addressChanged(const std::string& address);
+
+    /** Records that a committed block contains a transaction, it's removed
+     * from the mempool on the next publish */
+    void transactionIndexed(const std::string& txid);
+
+    /** Records that blocks were disconnected, every address is marked as
+     * changed on the next publish */
+    void blocksDisconnected();
+
+    /** Returns the last published snapshot. The snapshot is released once
+     * it's replaced and the last reader lets go of it.
+     */
+    std::shared_ptr<const leveldb::Snapshot> acquire();
+
+private:
+    leveldb::DB* db;
+    std::mutex currentMutex;
+    std::shared_ptr<const leveldb::Snapshot> current;
+    VtcBlockIndexer::ChangeCounters* changeCounters;
+    VtcBlockIndexer::MempoolMonitor* mempoolMonitor;
+    std::vector<std::string> changedAddresses;
+    std::vector<std::string> indexedTransactions;
+    bool disconnected;
+};
+
+}
+
+#endif // CHAINSNAPSHOT_H_INCLUDED
@@ -0,0 +1,67 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "changecounters.h"
+#include <functional>
+
+using namespace std;
+
+VtcBlockIndexer::ChangeCounters::ChangeCounters() : tipCounter(0), epoch(0), addressCounters(new atomic<uint64_t>[addressCounterCount]), listener(nullptr) {
+    for(size_t i = 0; i < addressCounterCount; i++) {
+        this->addressCounters[i] = 0;
+    }
+}
+
+void VtcBlockIndexer::ChangeCounters::addressChanged(const string& address) {
+    this->addressCounters[hash<string>()(address) % addressCounterCount]++;
+    VtcBlockIndexer::ChangeListener* listener = this->listener;
+    if(listener != nullptr) {
+        listener->addressChanged(address);
+    }
+}
+
+void VtcBlockIndexer::ChangeCounters::tipChanged() {
+    this->tipCounter++;
+    VtcBlockIndexer::ChangeListener* listener = this->listener;
+    if(listener != nullptr) {
+        listener->tipChanged();
+    }
+}
+
+void VtcBlockIndexer::ChangeCounters::allChanged() {
+    this->epoch++;
+    this->tipCounter++;
+    VtcBlockIndexer::ChangeListener* listener = this->listener;
+    if(listener != nullptr) {
+        listener->allChanged();
+    }
+}
+
+void VtcBlockIndexer::ChangeCounters::setListener(VtcBlockIndexer::ChangeListener* listener) {
+    this->listener = listener;
+}
+
+uint64_t VtcBlockIndexer::ChangeCounters::address(const string& address) const {
+    // Both only ever increase, so the sum changes whenever either does
+    return this->epoch + this->addressCounters[hash<string>()(address) % addressCounterCount];
+}
+
+uint64_t VtcBlockIndexer::ChangeCounters::tip() const {
+    return this->tipCounter;
+}
@@ -0,0 +1,94 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef CHANGECOUNTERS_H_INCLUDED
+#define CHANGECOUNTERS_H_INCLUDED
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+namespace VtcBlockIndexer {
+
+/**
+ * Interface for being told about changes as they're marked in the
+ * ChangeCounters. Called on the indexer and mempool threads, so
+ * implementations should only take note of the change and return.
+ */
+class ChangeListener {
+public:
+    virtual ~ChangeListener() {}
+    virtual void addressChanged(const std::string& address) = 0;
+    virtual void tipChanged() = 0;
+    virtual void allChanged() = 0;
+};
+
+/**
+ * The ChangeCounters class tells readers whether data they read earlier is
+ * still current. Every address maps to one of a fixed number of counters,
+ * which is increased whenever a published block or a mempool transaction
+ * touches the address. Addresses that share a counter only cause an
+ * unneeded refresh of each other.
+ *
+ * Writers change the data first and increase the counter after, so readers
+ * must read the counter before they read the data it covers.
+ */
+
+class ChangeCounters {
+public:
+    /** Constructs a ChangeCounters instance with all counters at 0
+     */
+    ChangeCounters();
+
+    /** Marks an address as changed */
+    void addressChanged(const std::string& address);
+
+    /** Marks the tip of the chain as moved */
+    void tipChanged();
+
+    /** Marks every address as changed, for when blocks are disconnected and
+     * the changed addresses aren't tracked */
+    void allChanged();
+
+    /** Returns the counter of an address */
+    uint64_t address(const std::string& address) const;
+
+    /** Returns the number of times the tip moved */
+    uint64_t tip() const;
+
+    /** Sets the listener that's told about every change, or nullptr */
+    void setListener(VtcBlockIndexer::ChangeListener* listener);
+
+private:
+    static const size_t addressCounterCount = 65536;
+
+    std::atomic<uint64_t> tipCounter;
+
+    // Added to every address counter, increased by allChanged
+    std::atomic<uint64_t> epoch;
+    std::unique_ptr<std::atomic<uint64_t>[]> addressCounters;
+    std::atomic<VtcBlockIndexer::ChangeListener*> listener;
+};
+
+}
+
+#endif // CHANGECOUNTERS_H_INCLUDED
@@ -0,0 +1,177 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "eventbroadcaster.h"
+#include "keybuilder.h"
+#include "json.hpp"
+#include <algorithm>
+
+using namespace std;
+using namespace restbed;
+using json = nlohmann::json;
+
+// Seconds without events after which a comment is sent, so proxies keep the
+// stream open and disconnected clients are noticed
+const time_t keepAliveInterval = 15;
+
+VtcBlockIndexer::EventBroadcaster::EventBroadcaster(leveldb::DB* dbInstance, VtcBlockIndexer::ChainSnapshot* chainSnapshot) : subscriberCount(0) {
+    this->db = dbInstance;
+    this->chainSnapshot = chainSnapshot;
+    this->tipMoved = false;
+    this->everythingChanged = false;
+}
+
+void VtcBlockIndexer::EventBroadcaster::subscribe(const shared_ptr<Session>& session, const vector<string>& addresses, bool blocks) {
+    shared_ptr<Subscriber> subscriber = make_shared<Subscriber>();
+    subscriber->addresses = addresses;
+    subscriber->blocks = blocks;
+    subscriber->lastSent = time(NULL);
+
+    // Proxies like nginx buffer responses unless told not to
+    const multimap<string, string> headers = {
+        { "Content-Type", "text/event-stream" },
+        { "Cache-Control", "no-cache" },
+        { "X-Accel-Buffering", "no" }
+    };
+    session->yield(OK, "", headers, [this, subscriber](const shared_ptr<Session> session) {
+        subscriber->session = session;
+        lock_guard<mutex> lock(this->eventsMutex);
+        for(const string& address : subscriber->addresses) {
+            this->watchedAddresses[address]++;
+        }
+        this->subscribers.push_back(subscriber);
+        this->subscriberCount = this->subscribers.size();
+    });
+}
+
+void VtcBlockIndexer::EventBroadcaster::addressChanged(const string& address) {
+    if(this->subscriberCount == 0) {
+        return;
+    }
+    lock_guard<mutex> lock(this->eventsMutex);
+    if(this->watchedAddresses.find(address) != this->watchedAddresses.end()) {
+        this->changedAddresses.insert(address);
+    }
+}
+
+void VtcBlockIndexer::EventBroadcaster::tipChanged() {
+    if(this->subscriberCount == 0) {
+        return;
+    }
+    lock_guard<mutex> lock(this->eventsMutex);
+    this->tipMoved = true;
+}
+
+void VtcBlockIndexer::EventBroadcaster::allChanged() {
+    if(this->subscriberCount == 0) {
+        return;
+    }
+    lock_guard<mutex> lock(this->eventsMutex);
+    this->everythingChanged = true;
+}
+
+string VtcBlockIndexer::EventBroadcaster::blockEvent() {
+    shared_ptr<const leveldb::Snapshot> snapshot = this->chainSnapshot->acquire();
+    leveldb::ReadOptions readOptions;
+    readOptions.snapshot = snapshot.get();
+
+    string highestBlock;
+    string blockHash;
+    if(!this->db->Get(readOptions, "highestblock", &highestBlock).ok()) {
+        return "";
+    }
+    long long height = stoll(highestBlock);
+    if(!this->db->Get(readOptions, VtcBlockIndexer::Keys::block(height).slice(), &blockHash).ok()) {
+        return "";
+    }
+
+    json j;
+    j["height"] = height;
+    j["hash"] = blockHash;
+    return "event: block\ndata: " + j.dump() + "\n\n";
+}
+
+void VtcBlockIndexer::EventBroadcaster::flush() {
+    lock_guard<mutex> flushLock(this->flushMutex);
+    vector<shared_ptr<Subscriber>> current;
+    unordered_set<string> changed;
+    bool tipMoved;
+    bool everythingChanged;
+    {
+        lock_guard<mutex> lock(this->eventsMutex);
+        current = this->subscribers;
+        changed.swap(this->changedAddresses);
+        tipMoved = this->tipMoved || this->everythingChanged;
+        everythingChanged = this->everythingChanged;
+        this->tipMoved = false;
+        this->everythingChanged = false;
+    }
+
+    string block = tipMoved ? blockEvent() : "";
+    const time_t now = time(NULL);
+
+    vector<shared_ptr<Subscriber>> closed;
+    for(const shared_ptr<Subscriber>& subscriber : current) {
+        if(subscriber->session->is_closed()) {
+            closed.push_back(subscriber);
+            continue;
+        }
+
+        string data;
+        if(subscriber->blocks) {
+            data.append(block);
+        }
+        for(const string& address : subscriber->addresses) {
+            if(everythingChanged || changed.find(address) != changed.end()) {
+                json j;
+                j["address"] = address;
+                data.append("event: address\ndata: ").append(j.dump()).append("\n\n");
+            }
+        }
+        if(data.empty() && now - subscriber->lastSent >= keepAliveInterval) {
+            data = ": keep-alive\n\n";
+        }
+        if(!data.empty()) {
+            subscriber->lastSent = now;
+
+            // Without a continuation restbed hands the session back to its router
+            // after the write, which ends the event stream
+            subscriber->session->yield(data, [](const shared_ptr<Session>) { });
+
+            // A failed write closes the session, drop it now instead of on the next flush
+            if(subscriber->session->is_closed()) {
+                closed.push_back(subscriber);
+            }
+        }
+    }
+
+    if(!closed.empty()) {
+        lock_guard<mutex> lock(this->eventsMutex);
+        for(const shared_ptr<Subscriber>& subscriber : closed) {
+            for(const string& address : subscriber->addresses) {
+                auto it = this->watchedAddresses.find(address);
+                if(it != this->watchedAddresses.end() && --it->second == 0) {
+                    this->watchedAddresses.erase(it);
+                }
+            }
+            this->subscribers.erase(remove(this->subscribers.begin(), this->subscribers.end(), subscriber), this->subscribers.end());
+        }
+        this->subscriberCount = this->subscribers.size();
+    }
+}
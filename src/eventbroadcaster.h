@@ -0,0 +1,116 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef EVENTBROADCASTER_H_INCLUDED
+#define EVENTBROADCASTER_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <ctime>
+#include <restbed>
+#include "leveldb/db.h"
+#include "changecounters.h"
+#include "chainsnapshot.h"
+
+namespace VtcBlockIndexer {
+
+/**
+ * The EventBroadcaster class pushes changes to clients over Server-Sent
+ * Events, so they don't have to poll for them. A client subscribes to new
+ * blocks and/or a set of addresses. It receives a "block" event with the
+ * new tip when blocks are published and an "address" event when a block or
+ * a mempool transaction touches one of its addresses, after which it can
+ * fetch what it needs.
+ *
+ * Changes are collected as they're marked in the ChangeCounters and sent out
+ * by flush, which the HTTP service runs periodically, so a burst of changes
+ * results in one event per address.
+ */
+
+class EventBroadcaster : public ChangeListener {
+public:
+    /** Constructs an EventBroadcaster instance
+     *
+     * @param dbInstance The index, read for the tip of block events
+     * @param chainSnapshot Provides the snapshot the tip is read from
+     */
+    EventBroadcaster(leveldb::DB* dbInstance, VtcBlockIndexer::ChainSnapshot* chainSnapshot);
+
+    /** Starts an event stream on the session
+     *
+     * @param session The session to send the events on
+     * @param addresses Addresses to send address events for
+     * @param blocks Send block events
+     */
+    void subscribe(const std::shared_ptr<restbed::Session>& session, const std::vector<std::string>& addresses, bool blocks);
+
+    /** Sends the events collected since the last call to the subscribers, and
+     * drops the subscribers that disconnected */
+    void flush();
+
+    void addressChanged(const std::string& address);
+    void tipChanged();
+    void allChanged();
+
+private:
+    struct Subscriber {
+        std::shared_ptr<restbed::Session> session;
+        std::vector<std::string> addresses;
+        bool blocks;
+
+        // When something was last written to the stream, only used by flush
+        time_t lastSent;
+    };
+
+    /** Returns the block event for the published tip, or an empty string if
+     * nothing is indexed yet */
+    std::string blockEvent();
+
+    leveldb::DB* db;
+    VtcBlockIndexer::ChainSnapshot* chainSnapshot;
+
+    // Held by flush, the scheduler may run it on several threads
+    std::mutex flushMutex;
+
+    // Lets the indexer skip the lock while nobody is subscribed
+    std::atomic<size_t> subscriberCount;
+
+    // Guards the members below
+    std::mutex eventsMutex;
+    std::vector<std::shared_ptr<Subscriber>> subscribers;
+
+    // Number of subscribers per address
+    std::unordered_map<std::string, size_t> watchedAddresses;
+
+    // Changes collected for the next flush
+    std::unordered_set<std::string> changedAddresses;
+    bool tipMoved;
+    bool everythingChanged;
+};
+
+}
+
+#endif // EVENTBROADCASTER_H_INCLUDED
@@ -26,89 +26,238 @@
 #include <vector>
 #include <memory>
 #include <cstdlib>
+#include <unordered_set>
+#include <algorithm>
+#include <thread>
+#include <ctime>
+#include <climits>
+#include <cctype>
 #include <restbed>
 #include "json.hpp"
 #include "utility.h"
+#include "keybuilder.h"
+#include "batchlookup.h"
+#include "byte_array_buffer.h"
 using namespace std;
 using namespace restbed;
 using json = nlohmann::json;
 
+// Most outputs returned per page of address history, unless all of it is requested
+const long long maxTxoPageSize = 1000;
 
-VtcBlockIndexer::HttpServer::HttpServer(leveldb::DB* dbInstance, VtcBlockIndexer::MempoolMonitor* mempoolMonitor, string blocksDir) : blockReader("") {
+// Most addresses a batch request may ask for
+const size_t maxBatchAddresses = 500;
+
+// Default and maximum number of TXOs per address in a batch history
+const long long maxBatchTxoPageSize = 100;
+
+// Total size of the responses kept in the response cache
+const size_t responseCacheSize = 64 * 1024 * 1024;
+
+VtcBlockIndexer::HttpServer::HttpServer(leveldb::DB* dbInstance, VtcBlockIndexer::MempoolMonitor* mempoolMonitor, VtcBlockIndexer::ChainSnapshot* chainSnapshot, VtcBlockIndexer::ChangeCounters* changeCounters, VtcBlockIndexer::BlockSummaryFile* blockSummaries, string blocksDir) : blockReader("") {
     this->db = dbInstance;
+    this->chainSnapshot = chainSnapshot;
+    this->changeCounters = changeCounters;
+    this->responseCache.reset(new VtcBlockIndexer::ResponseCache(responseCacheSize));
+    this->lookupPool.reset(new VtcBlockIndexer::WorkerPool());
+    this->eventBroadcaster.reset(new VtcBlockIndexer::EventBroadcaster(dbInstance, chainSnapshot));
+    changeCounters->setListener(this->eventBroadcaster.get());
+    stringstream startTime;
+    startTime << hex << time(NULL);
+    this->etagPrefix = startTime.str();
+    this->blockSummaries = blockSummaries;
     this->blocksDir = blocksDir;
     this->blockReader = VtcBlockIndexer::BlockReader(blocksDir);
+    this->blockFiles.reset(new VtcBlockIndexer::BlockFileCache(blocksDir, 64));
     this->mempoolMonitor = mempoolMonitor;
-    httpClient.reset(new jsonrpc::HttpClient("http://middleware:middleware@" + std::string(std::getenv("VERTCOIND_HOST")) + ":8332"));
-    vertcoind.reset(new VertcoinClient(*httpClient));
+    this->vertcoindUrl = "http://middleware:middleware@" + std::string(std::getenv("VERTCOIND_HOST")) + ":8332";
+}
+
+VtcBlockIndexer::VertcoinClient& VtcBlockIndexer::HttpServer::vertcoin() {
+    // The RPC client isn't safe to share between threads, so every worker
+    // gets its own connection to vertcoind
+    thread_local unique_ptr<jsonrpc::HttpClient> httpClient;
+    thread_local unique_ptr<VtcBlockIndexer::VertcoinClient> client;
+    if(!client) {
+        httpClient.reset(new jsonrpc::HttpClient(this->vertcoindUrl));
+        client.reset(new VtcBlockIndexer::VertcoinClient(*httpClient));
+    }
+    return *client;
+}
+
+bool VtcBlockIndexer::HttpServer::keepAlive(const shared_ptr<Session>& session) {
+    string connection = session->get_request()->get_header("Connection", string(""));
+    transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+    return connection.compare("close") != 0;
+}
+
+void VtcBlockIndexer::HttpServer::respond(const shared_ptr<Session>& session, int status, const string& body, const multimap<string, string>& headers) {
+    if(!keepAlive(session)) {
+        session->close(status, body, headers);
+    } else {
+        // Sends the response and waits for the next request on the connection
+        session->yield(status, body, headers);
+    }
+}
+
+string VtcBlockIndexer::HttpServer::cacheKey(const shared_ptr<Session>& session) {
+    const auto request = session->get_request();
+    string key = request->get_path();
+    for(const auto& parameter : request->get_query_parameters()) {
+        key.append("&").append(parameter.first).append("=").append(parameter.second);
+    }
+    return key;
+}
+
+string VtcBlockIndexer::HttpServer::etag(uint64_t version) {
+    return "\"" + this->etagPrefix + "-" + std::to_string(version) + "\"";
+}
+
+bool VtcBlockIndexer::HttpServer::respondCached(const shared_ptr<Session>& session, const string& key, uint64_t version) {
+    const string tag = etag(version);
+    const string ifNoneMatch = session->get_request()->get_header("If-None-Match", string(""));
+    if(ifNoneMatch.compare("*") == 0 || ifNoneMatch.find(tag) != string::npos) {
+        respond(session, 304, "", { { "ETag", tag } });
+        return true;
+    }
+
+    VtcBlockIndexer::ResponseCache::Response response;
+    if(!this->responseCache->get(key, version, response)) {
+        return false;
+    }
+    // Streamed responses are cached without a length
+    response.headers.erase("Content-Length");
+    response.headers.insert({ "Content-Length", std::to_string(response.body.size()) });
+    respond(session, response.status, response.body, response.headers);
+    return true;
+}
+
+void VtcBlockIndexer::HttpServer::respondAndCache(const shared_ptr<Session>& session, const string& key, uint64_t version, int status, const string& body, const multimap<string, string>& headers) {
+    multimap<string, string> taggedHeaders = headers;
+    taggedHeaders.insert({ "ETag", etag(version) });
+    respond(session, status, body, taggedHeaders);
+    this->responseCache->put(key, version, { status, body, taggedHeaders });
 }
 
+VtcBlockIndexer::JsonArrayStream::Completion VtcBlockIndexer::HttpServer::cacheStream(const string& key, uint64_t version, const multimap<string, string>& headers) {
+    VtcBlockIndexer::ResponseCache* cache = this->responseCache.get();
+    return [cache, key, version, headers](const string& body) {
+        cache->put(key, version, { OK, body, headers });
+    };
+}
+
+leveldb::ReadOptions VtcBlockIndexer::HttpServer::snapshotReadOptions(shared_ptr<const leveldb::Snapshot>& snapshot) {
+    snapshot = this->chainSnapshot->acquire();
+    leveldb::ReadOptions readOptions;
+    readOptions.snapshot = snapshot.get();
+    return readOptions;
+}
 
+leveldb::Iterator* VtcBlockIndexer::HttpServer::newScanIterator(const leveldb::ReadOptions& readOptions) {
+    leveldb::ReadOptions scanOptions = readOptions;
+    scanOptions.fill_cache = false;
+    return this->db->NewIterator(scanOptions);
+}
+
+bool VtcBlockIndexer::HttpServer::getBlockSummary(const leveldb::ReadOptions& readOptions, uint64_t height, VtcBlockIndexer::BlockSummary& summary) {
+    // The record is only trusted when it belongs to the block the snapshot
+    // has at this height, which also rules out a record that's being rewritten
+    string blockHash;
+    if(!this->db->Get(readOptions, VtcBlockIndexer::Keys::block(height).slice(), &blockHash).ok()) {
+        return false;
+    }
+    if(this->blockSummaries->read(height, summary) && summary.blockHash() == blockHash) {
+        return true;
+    }
+    return VtcBlockIndexer::BlockSummaryFile::readFromIndex(this->db, readOptions, height, summary);
+}
 
 void VtcBlockIndexer::HttpServer::getTransaction(const shared_ptr<Session> session) {
+    shared_ptr<const leveldb::Snapshot> snapshot;
+    leveldb::ReadOptions readOptions = snapshotReadOptions(snapshot);
     const auto request = session->get_request();
+    const string txId = request->get_path_parameter("id");
     
-    cout << "Looking up txid " << request->get_path_parameter("id") << endl;
+    cout << "Looking up txid " << txId << endl;
+
+    // Confirmed transactions are decoded from the block files, vertcoind is
+    // only asked for transactions that aren't in a block yet
+    string txLocation;
+    VtcBlockIndexer::TransactionLocation location;
+    VtcBlockIndexer::BlockSummary summary;
+    vector<unsigned char> rawTx;
+    leveldb::Status s = this->db->Get(readOptions, VtcBlockIndexer::Keys::tx(txId).slice(), &txLocation);
+    if(s.ok() && VtcBlockIndexer::Utility::decodeTransactionLocation(txLocation, location) &&
+        getBlockSummary(readOptions, location.height, summary) &&
+        blockFiles->readRawTransaction(location.fileName, location.filePosition, rawTx)) {
+
+        string highestBlockString;
+        this->db->Get(readOptions, "highestblock", &highestBlockString);
+
+        json j = decodeTransaction(rawTx, summary.testnet == 1);
+        j["blockhash"] = summary.blockHash();
+        j["confirmations"] = highestBlockString.empty() ? 1 : stoll(highestBlockString) - (long long)location.height + 1;
+        j["time"] = summary.time;
+        j["blocktime"] = summary.time;
+
+        const string body = j.dump();
+        respond(session, OK, body, {{"Content-Type","application/json"},{"Content-Length",  std::to_string(body.size())}});
+        return;
+    }
     
     try {
-        const Json::Value tx = vertcoind->getrawtransaction(request->get_path_parameter("id"), true);
+        const Json::Value tx = vertcoin().getrawtransaction(txId, true);
         
         stringstream body;
         body << tx.toStyledString();
         
-        session->close(OK, body.str(), {{"Content-Type","application/json"},{"Content-Length",  std::to_string(body.str().size())}});
+        respond(session, OK, body.str(), {{"Content-Type","application/json"},{"Content-Length",  std::to_string(body.str().size())}});
     } catch(const jsonrpc::JsonRpcException& e) {
         const std::string message(e.what());
         cout << "Not found " << message << endl;
-        session->close(404, message, {{"Content-Type","application/json"},{"Content-Length",  std::to_string(message.size())}});
+        respond(session, 404, message, {{"Content-Type","application/json"},{"Content-Length",  std::to_string(message.size())}});
     }
 }
 
 
 void VtcBlockIndexer::HttpServer::getTransactionProof(const shared_ptr<Session> session) {
+    shared_ptr<const leveldb::Snapshot> snapshot;
+    leveldb::ReadOptions readOptions = snapshotReadOptions(snapshot);
     const auto request = session->get_request();
     
-    std::string blockHash;
+    std::string txLocation;
     std::string txId = request->get_path_parameter("id","");
-    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), "tx-" + txId + "-block", &blockHash);
-    if(!s.ok()) // no key found
+    VtcBlockIndexer::TransactionLocation location;
+    leveldb::Status s = this->db->Get(readOptions, VtcBlockIndexer::Keys::tx(txId).slice(), &txLocation);
+    if(!s.ok() || !VtcBlockIndexer::Utility::decodeTransactionLocation(txLocation, location)) // no key found
     {
         const std::string message("TX not found");
-        session->close(404, message, {{"Content-Length",  std::to_string(message.size())}});
+        respond(session, 404, message, {{"Content-Length",  std::to_string(message.size())}});
         return;
     }
 
-    std::string blockHeightString;
-    s = this->db->Get(leveldb::ReadOptions(), "block-hash-" + blockHash, &blockHeightString);
-    if(!s.ok()) // no key found
+    VtcBlockIndexer::BlockSummary summary;
+    if(!getBlockSummary(readOptions, location.height, summary))
     {
         const std::string message("Block not found");
-        session->close(404, message, {{"Content-Length",  std::to_string(message.size())}});
+        respond(session, 404, message, {{"Content-Length",  std::to_string(message.size())}});
         return;
     }
-    uint64_t blockHeight = stoll(blockHeightString);
+    uint64_t blockHeight = location.height;
     json j;
     j["txHash"] = txId;
-    j["blockHash"] = blockHash;
+    j["blockHash"] = summary.blockHash();
     j["blockHeight"] = blockHeight;
+    j["txIndex"] = location.txIndex;
     json chain = json::array();
     for(uint64_t i = blockHeight+1; --i > 0 && i > blockHeight-10;) {
-        stringstream blockKey;
-        blockKey << "block-filePosition-" << setw(8) << setfill('0') << i;
-   
-        std::string filePosition;
-        s = this->db->Get(leveldb::ReadOptions(), blockKey.str(), &filePosition);
-        if(!s.ok()) // no key found
+        if(!getBlockSummary(readOptions, i, summary))
         {
             const std::string message("Block not found");
-            session->close(404, message, {{"Content-Length",  std::to_string(message.size())}});
+            respond(session, 404, message, {{"Content-Length",  std::to_string(message.size())}});
             return;
         }
-        bool testnet = false;
-        if(filePosition.size() > 24) {
-            testnet = (stoi(filePosition.substr(24)) == 1);
-        }
-        Block block = this->blockReader.readBlock(filePosition.substr(0,12),stoll(filePosition.substr(12,12)),i,testnet,true);
+        Block block = this->blockReader.readBlock(summary.blockFileName(),summary.filePosition,i,summary.testnet == 1,true);
 
         json jsonBlock;
         jsonBlock["blockHash"] = block.blockHash;
@@ -125,21 +274,23 @@ void VtcBlockIndexer::HttpServer::getTransactionProof(const shared_ptr<Session>
     j["chain"] = chain;
     string body = j.dump();
     
-   session->close( OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
+   respond( session, OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
 }
 
 void VtcBlockIndexer::HttpServer::sync(const shared_ptr<Session> session) {
+    shared_ptr<const leveldb::Snapshot> snapshot;
+    leveldb::ReadOptions readOptions = snapshotReadOptions(snapshot);
     json j;
 
     const auto request = session->get_request( );
 
     string highestBlockString;
-    this->db->Get(leveldb::ReadOptions(),"highestblock",&highestBlockString);
+    this->db->Get(readOptions,"highestblock",&highestBlockString);
 
     j["error"] = nullptr;
     j["height"] = stoll(highestBlockString);
     try {
-        const Json::Value blockCount = vertcoind->getblockcount();
+        const Json::Value blockCount = vertcoin().getblockcount();
         
         j["blockChainHeight"] = blockCount.asInt();
     } catch(const jsonrpc::JsonRpcException& e) {
@@ -157,235 +308,525 @@ void VtcBlockIndexer::HttpServer::sync(const shared_ptr<Session> session) {
     }
 
     string body = j.dump();
-    session->close( OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
+    respond( session, OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
 }
 
 void VtcBlockIndexer::HttpServer::getBlocks(const shared_ptr<Session> session) {
+    // The counter is read before the snapshot, so a response is never cached
+    // under a newer tip than it was built from
+    const string key = cacheKey(session);
+    const uint64_t version = this->changeCounters->tip();
+    if(respondCached(session, key, version)) {
+        return;
+    }
+
+    shared_ptr<const leveldb::Snapshot> snapshot;
+    leveldb::ReadOptions readOptions = snapshotReadOptions(snapshot);
     json j = json::array();
 
     const auto request = session->get_request( );
 
     string highestBlockString;
-    this->db->Get(leveldb::ReadOptions(),"highestblock",&highestBlockString);
-    
-   
+    leveldb::Status s = this->db->Get(readOptions,"highestblock",&highestBlockString);
+    long long highestBlock = s.ok() ? stoll(highestBlockString) : -1;
+
     long long limitParam = stoi(request->get_query_parameter("limit","0"));
     if(limitParam == 0 || limitParam > 100)
         limitParam = 100;
 
-    long long lowestBlock = stoll(highestBlockString)-limitParam;
-    stringstream lowestBlockString;
-    lowestBlockString << setw(8) << setfill('0') << lowestBlock;
+    long long lowestBlock = highestBlock-limitParam;
 
-    string start("block-" + highestBlockString);
-    string limit("block-" + lowestBlockString.str());
-    
-    leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
-    for (it->Seek(start);
-            it->Valid() && it->key().ToString() > limit;
-            it->Prev()) {
+    for(long long height = highestBlock; height > lowestBlock && height >= 0; height--) {
+        VtcBlockIndexer::BlockSummary summary;
+        if(!getBlockSummary(readOptions, height, summary)) {
+            break;
+        }
         json blockObj;
-        string blockHeightString = it->key().ToString().substr(6);
-        blockObj["hash"] = it->value().ToString();
-        string blockSizeString;
-        string blockTxesString;
-        string blockTimeString;
-        this->db->Get(leveldb::ReadOptions(),"block-size-" + blockHeightString,&blockSizeString);
-        this->db->Get(leveldb::ReadOptions(),"block-txcount-" + blockHeightString,&blockTxesString);
-        this->db->Get(leveldb::ReadOptions(),"block-time-" + blockHeightString,&blockTimeString);
-        blockObj["height"] = stoll(blockHeightString);
-        blockObj["size"] = stoll(blockSizeString);
-        blockObj["time"] = stoll(blockTimeString);
-        blockObj["txlength"] = stoll(blockTxesString);
+        blockObj["hash"] = summary.blockHash();
+        blockObj["height"] = height;
+        blockObj["size"] = summary.size;
+        blockObj["time"] = summary.time;
+        blockObj["txlength"] = summary.txCount;
         blockObj["poolInfo"] = nullptr;
         j.push_back(blockObj);
     }
 
     string body = j.dump();
     
-   session->close( OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
+    respondAndCache( session, key, version, OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
 
 }
 
 void VtcBlockIndexer::HttpServer::addressBalance( const shared_ptr< Session > session )
 {
-    long long balance = 0;
-    int txoCount = 0;
     const auto request = session->get_request( );
-    
-    cout << "Checking balance for address " << request->get_path_parameter( "address" ) << endl;
+    string address = request->get_path_parameter( "address" );
 
-    string start(request->get_path_parameter( "address" ) + "-txo-00000001");
-    string limit(request->get_path_parameter( "address" ) + "-txo-99999999");
-    
-    leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
+    const string key = cacheKey(session);
+    const uint64_t version = this->changeCounters->address(address);
+    if(respondCached(session, key, version)) {
+        return;
+    }
+
+    shared_ptr<const leveldb::Snapshot> snapshot;
+    leveldb::ReadOptions readOptions = snapshotReadOptions(snapshot);
     
-    for (it->Seek(start);
-            it->Valid() && it->key().ToString() < limit;
-            it->Next()) {
+    cout << "Checking balance for address " << address << endl;
 
-        string spentTx;
-        txoCount++;
-        string txo = it->value().ToString();
+    // The confirmed totals are maintained by the indexer
+    string balanceValue;
+    this->db->Get(readOptions, address + "-balance", &balanceValue);
+    VtcBlockIndexer::AddressBalance confirmed = VtcBlockIndexer::Utility::decodeAddressBalance(balanceValue);
+    long long balance = confirmed.received - confirmed.spent;
 
-        leveldb::Status s = this->db->Get(leveldb::ReadOptions(), "txo-" + txo.substr(0,64) + "-" + txo.substr(64,8) + "-spent", &spentTx);
-        if(!s.ok()) // no key found, not spent. Add balance.
-        {
-            // check mempool for spenders
-            string spender = mempoolMonitor->outpointSpend(txo.substr(0,64), stol(txo.substr(64,8)));
-            if(spender.compare("") == 0) {
-                balance += stoll(txo.substr(80));
-            }
-        }
-    }
-    assert(it->status().ok());  // Check for any errors found during the scan
-    delete it;
-
-    cout << "Analyzed " << txoCount << " TXOs - Balance is " << balance << endl;
- 
-    // Add mempool transactions
-    vector<VtcBlockIndexer::TransactionOutput> mempoolOutputs = mempoolMonitor->getTxos(request->get_path_parameter( "address" ));
-    for (VtcBlockIndexer::TransactionOutput txo : mempoolOutputs) {
-        txoCount++;
-        string spender = mempoolMonitor->outpointSpend(txo.txHash, txo.index);
-        cout << "Spender for " << txo.txHash << "/" << txo.index << " = " << spender;
-        if(spender.compare("") == 0) {
-            balance += txo.value;
-        }
-    }
+    cout << "Analyzed " << confirmed.txoCount << " TXOs - Balance is " << balance << endl;
 
-    cout << "Including mempool: Analyzed " << txoCount << " TXOs - Balance is " << balance << endl;
+    balance += mempoolBalanceChange(address);
+
+    cout << "Including mempool: Balance is " << balance << endl;
     
 
     stringstream body;
     body << balance;
     
-    session->close( OK, body.str(), { {"Content-Type","text/plain"}, { "Content-Length",  std::to_string(body.str().size()) } } );
+    respondAndCache( session, key, version, OK, body.str(), { {"Content-Type","text/plain"}, { "Content-Length",  std::to_string(body.str().size()) } } );
 }
 
 void VtcBlockIndexer::HttpServer::addressTxos( const shared_ptr< Session > session )
 {
-    json j = json::array();
-
     const auto request = session->get_request( );
 
     long long sinceBlock = stoll(request->get_path_parameter( "sinceBlock", "0" ));
     
-    int txHashOnly = stoi(request->get_query_parameter("txHashOnly","0"));
-    int raw = stoi(request->get_query_parameter("raw","0"));
-    
-    cout << "Fetching address txos for address " << request->get_path_parameter( "address" ) << endl;
-   
-    string start(request->get_path_parameter( "address" ) + "-txo-00000001");
-    string limit(request->get_path_parameter( "address" ) + "-txo-99999999");
-    
-    leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
+    bool txHashOnly = stoi(request->get_query_parameter("txHashOnly","0")) != 0;
+    bool raw = stoi(request->get_query_parameter("raw","0")) != 0;
+    bool newestFirst = (request->get_query_parameter("order","asc").compare("desc") == 0);
+    string address = request->get_path_parameter( "address" );
+
+    // History is returned in pages. The cursor is the position of the last
+    // output of the previous page (hex of "<height>-<sequence>"), the page
+    // continues after it. all=1 returns the whole history in one response.
+    bool allTxos = (request->get_query_parameter("all","0").compare("1") == 0);
+    long long pageSize = stoll(request->get_query_parameter("limit","0"));
+    if(pageSize <= 0 || pageSize > maxTxoPageSize) {
+        pageSize = maxTxoPageSize;
+    }
+    string cursor = request->get_query_parameter("cursor","");
+    string cursorKey;
+    if(!cursor.empty() && !allTxos) {
+        // The position must be "<height>-<sequence>" exactly as it's in the key
+        const size_t positionSize = VtcBlockIndexer::Keys::addressTxoSuffixSize - 5;
+        bool valid = cursor.size() == 2 * positionSize && cursor.find_first_not_of("0123456789abcdefABCDEF") == string::npos;
+        string positionString;
+        if(valid) {
+            vector<unsigned char> position = VtcBlockIndexer::Utility::hexToBytes(cursor);
+            positionString.assign(position.begin(), position.end());
+            for(size_t i = 0; i < positionString.size(); i++) {
+                if(i == VtcBlockIndexer::KeyWidth::Height ? positionString.at(i) != '-' : !isdigit((unsigned char)positionString.at(i))) {
+                    valid = false;
+                    break;
+                }
+            }
+        }
+        if(!valid) {
+            const std::string message("Invalid cursor");
+            respond(session, 400, message, {{"Content-Length",  std::to_string(message.size())}});
+            return;
+        }
+        cursorKey = address + "-txo-" + positionString;
+    }
+
+    const string key = cacheKey(session);
+    const uint64_t version = this->changeCounters->address(address);
+    if(respondCached(session, key, version)) {
+        return;
+    }
+
+    shared_ptr<ScanState> scan = make_shared<ScanState>();
+    scan->readOptions = snapshotReadOptions(scan->snapshot);
     
-    for (it->Seek(start);
-            it->Valid() && it->key().ToString() < limit;
-            it->Next()) {
+    cout << "Fetching address txos for address " << address << endl;
+
+    // Address history is ordered by height, so seek straight to sinceBlock
+    scan->start = VtcBlockIndexer::Keys::addressTxoFrom(address, sinceBlock).str();
+    scan->limit = address + "-txo-~";
+    scan->reverse = newestFirst;
+
+    scan->it.reset(newScanIterator(scan->readOptions));
+    leveldb::Iterator* it = scan->it.get();
+    if(newestFirst) {
+        it->Seek(cursorKey.empty() ? scan->limit : cursorKey);
+        if(it->Valid()) {
+            it->Prev();
+        } else {
+            it->SeekToLast();
+        }
+    } else if(cursorKey.compare(scan->start) > 0) {
+        it->Seek(cursorKey);
+        if(it->Valid() && it->key().compare(cursorKey) == 0) {
+            it->Next();
+        }
+    } else {
+        it->Seek(scan->start);
+    }
 
-        string spentTx;
-        string txo = it->value().ToString();
-
-        leveldb::Status s = this->db->Get(leveldb::ReadOptions(), "txo-" + txo.substr(0,64) + "-" + txo.substr(64,8) + "-spent", &spentTx);
-        long long block = stoll(txo.substr(72,8));
-        if(block >= sinceBlock) {
-            json txoObj;
-            txoObj["height"] = block;
-
-            if(raw != 0) {
-                try {
-                    const Json::Value tx = vertcoind->getrawtransaction(txo.substr(0,64), false);
-                    txoObj["tx"] = tx.asString();
-                } catch(const jsonrpc::JsonRpcException& e) {
-                    const std::string message(e.what());
-                    cout << "Not found " << message << endl;
-                }
+    // The cursor of the next page is sent in the headers, so find out where
+    // this page ends before streaming it. Only the keys are read here.
+    string nextCursor;
+    if(!allTxos) {
+        const size_t positionSize = VtcBlockIndexer::Keys::addressTxoSuffixSize - 5;
+        string firstKey;
+        string lastPosition;
+        scan->remaining = 0;
+        for (;
+                it->Valid() && it->key().compare(scan->start) >= 0 && it->key().compare(scan->limit) < 0;
+                newestFirst ? it->Prev() : it->Next()) {
+            if(scan->remaining == pageSize) {
+                nextCursor = VtcBlockIndexer::KeyBuilder().appendHex((const unsigned char*)lastPosition.data(), lastPosition.size()).str();
+                break;
             }
+            if(firstKey.empty()) {
+                firstKey = it->key().ToString();
+            }
+            lastPosition = it->key().ToString().substr(it->key().size() - positionSize);
+            scan->remaining++;
+        }
+        if(!firstKey.empty()) {
+            it->Seek(firstKey);
+        }
+    }
 
-            if(!s.ok()) {
-                string spender = mempoolMonitor->outpointSpend(txo.substr(0,64), stol(txo.substr(64,8)));
-                if(spender.compare("") == 0) {
-                    txoObj["spender"] = nullptr;
-                } else {
-                    txoObj["spender"] = spender;
-                }
-               
-            } else {
-                txoObj["spender"] = spentTx.substr(65, 64);
+    // Unconfirmed outputs are the newest, so they lead the first page when
+    // listing newest first, or follow the last page otherwise
+    if(newestFirst && cursorKey.empty()) {
+        scan->leading = mempoolTxos(address);
+    } else if(!newestFirst && nextCursor.empty()) {
+        scan->trailing = mempoolTxos(address);
+    }
+
+    multimap<string, string> headers = { { "Content-Type",  "application/json" }, { "ETag", etag(version) } };
+    if(!nextCursor.empty()) {
+        headers.insert({ "X-Next-Cursor", nextCursor });
+    }
+    streamScan(session, headers, scan, [this, scan, raw, txHashOnly](leveldb::Iterator* it, json& element) {
+        element = txoJson(it->value().ToString(), scan->readOptions, raw, txHashOnly);
+        return true;
+    }, cacheStream(key, version, headers));
+}
+
+json VtcBlockIndexer::HttpServer::txoJson(const string& txo, const leveldb::ReadOptions& readOptions, bool raw, bool txHashOnly)
+{
+    string spentTx;
+    leveldb::Status s = this->db->Get(readOptions, VtcBlockIndexer::Keys::txoSpent(txo.substr(0,64), stoul(txo.substr(64,8))).slice(), &spentTx);
+    long long block = stoll(txo.substr(72,8));
+    json txoObj;
+    txoObj["height"] = block;
+
+    if(raw) {
+        string rawTx = rawTransactionHex(txo.substr(0,64), readOptions);
+        if(!rawTx.empty()) {
+            txoObj["tx"] = rawTx;
+        }
+    }
+
+    if(!s.ok()) {
+        string spender = mempoolMonitor->outpointSpend(txo.substr(0,64), stol(txo.substr(64,8)));
+        if(spender.compare("") == 0) {
+            txoObj["spender"] = nullptr;
+        } else {
+            txoObj["spender"] = spender;
+        }
+       
+    } else {
+        txoObj["spender"] = spentTx.substr(65, 64);
+    }
+
+    if(raw && txoObj["spender"].is_string()) {
+        string rawSpender = rawTransactionHex(txoObj["spender"].get<string>(), readOptions);
+        if(!rawSpender.empty()) {
+            txoObj["spender"] = rawSpender;
+        }
+    }
+
+    if(!raw) {
+        txoObj["txhash"] = txo.substr(0,64);
+    }
+    if(!txHashOnly && !raw) {
+        txoObj["vout"] = stoll(txo.substr(64,8));
+        txoObj["value"] = stoll(txo.substr(80));
+    }
+    return txoObj;
+}
+
+string VtcBlockIndexer::HttpServer::rawTransactionHex(const string& txid, const leveldb::ReadOptions& readOptions)
+{
+    string location;
+    VtcBlockIndexer::TransactionLocation tx;
+    leveldb::Status s = this->db->Get(readOptions, VtcBlockIndexer::Keys::tx(txid).slice(), &location);
+    if(s.ok() && VtcBlockIndexer::Utility::decodeTransactionLocation(location, tx)) {
+        vector<unsigned char> rawTx;
+        if(blockFiles->readRawTransaction(tx.fileName, tx.filePosition, rawTx)) {
+            return VtcBlockIndexer::Utility::hashToHex(rawTx);
+        }
+        cout << "Transaction " << txid << " could not be read from " << tx.fileName << endl;
+    }
+
+    try {
+        return vertcoin().getrawtransaction(txid, false).asString();
+    } catch(const jsonrpc::JsonRpcException& e) {
+        const std::string message(e.what());
+        cout << "Not found " << message << endl;
+    }
+    return "";
+}
+
+json VtcBlockIndexer::HttpServer::decodeTransaction(const vector<unsigned char>& raw, bool testnet)
+{
+    byte_array_buffer streambuf(raw.data(), raw.size());
+    std::istream stream(&streambuf);
+    VtcBlockIndexer::Transaction tx = this->blockReader.readTransaction(stream);
+
+    VtcBlockIndexer::ScriptSolver solver;
+    solver.testnet = testnet;
+
+    auto varIntSize = [](uint64_t value) -> uint64_t {
+        return value < 253 ? 1 : (value <= 0xFFFF ? 3 : (value <= 0xFFFFFFFF ? 5 : 9));
+    };
+
+    // The witness doesn't count towards the stripped size
+    bool segwit = raw.size() > 5 && raw[4] == 0x00 && raw[5] != 0x00;
+    uint64_t witnessSize = segwit ? 2 : 0;
+
+    json vin = json::array();
+    for(const VtcBlockIndexer::TransactionInput& txi : tx.inputs) {
+        json input;
+        if(txi.coinbase) {
+            input["coinbase"] = VtcBlockIndexer::Utility::hashToHex(txi.script);
+        } else {
+            input["txid"] = txi.txHash;
+            input["vout"] = txi.txoIndex;
+            input["scriptSig"] = { { "hex", VtcBlockIndexer::Utility::hashToHex(txi.script) } };
+        }
+        if(segwit) {
+            witnessSize += varIntSize(txi.witnessData.size());
+        }
+        if(!txi.witnessData.empty()) {
+            json witness = json::array();
+            for(const vector<unsigned char>& item : txi.witnessData) {
+                witness.push_back(VtcBlockIndexer::Utility::hashToHex(item));
+                witnessSize += varIntSize(item.size()) + item.size();
             }
+            input["txinwitness"] = witness;
+        }
+        input["sequence"] = txi.sequence;
+        vin.push_back(input);
+    }
+
+    json vout = json::array();
+    for(const VtcBlockIndexer::TransactionOutput& out : tx.outputs) {
+        json scriptPubKey;
+        scriptPubKey["hex"] = VtcBlockIndexer::Utility::hashToHex(out.script);
+        scriptPubKey["type"] = VtcBlockIndexer::ScriptSolver::getScriptType(out.script);
+        int reqSigs = VtcBlockIndexer::ScriptSolver::getRequiredSignatures(out.script);
+        if(reqSigs > 0) {
+            scriptPubKey["reqSigs"] = reqSigs;
+        }
+        vector<string> addresses = solver.getAddressesFromScript(out.script);
+        if(!addresses.empty()) {
+            scriptPubKey["addresses"] = addresses;
+        }
+
+        // A double can't hold every amount in coins exactly, so the value is
+        // written as a decimal string from the satoshis
+        stringstream value;
+        value << out.value / 100000000 << "." << setw(8) << setfill('0') << out.value % 100000000;
+
+        json output;
+        output["value"] = value.str();
+        output["n"] = out.index;
+        output["scriptPubKey"] = scriptPubKey;
+        vout.push_back(output);
+    }
+
+    uint64_t weight = (raw.size() - witnessSize) * 3 + raw.size();
+
+    json j;
+    j["hex"] = VtcBlockIndexer::Utility::hashToHex(raw);
+    j["txid"] = tx.txHash;
+    j["hash"] = tx.txWitHash;
+    j["version"] = tx.version;
+    j["size"] = raw.size();
+    j["vsize"] = (weight + 3) / 4;
+    j["weight"] = weight;
+    j["locktime"] = tx.lockTime;
+    j["vin"] = vin;
+    j["vout"] = vout;
+    return j;
+}
 
-            if(raw != 0 && txoObj["spender"].is_string()) {
-                try {
-                    const Json::Value tx = vertcoind->getrawtransaction(txoObj["spender"].get<string>(), false);
-                    txoObj["spender"] = tx.asString();
-                } catch(const jsonrpc::JsonRpcException& e) {
-                    const std::string message(e.what());
-                    cout << "Not found " << message << endl;
+void VtcBlockIndexer::HttpServer::streamScan(const shared_ptr<Session>& session, const multimap<string, string>& headers, shared_ptr<ScanState> scan, EntryConverter convert, VtcBlockIndexer::JsonArrayStream::Completion completion)
+{
+    VtcBlockIndexer::JsonArrayStream::send(session, headers, [scan, convert](json& element) {
+        if(scan->leadingIndex < scan->leading.size()) {
+            element = std::move(scan->leading.at(scan->leadingIndex++));
+            return true;
+        }
+        leveldb::Iterator* it = scan->it.get();
+        while(scan->remaining != 0 && it->Valid() && it->key().compare(scan->start) >= 0 && it->key().compare(scan->limit) < 0) {
+            bool converted = convert(it, element);
+            scan->reverse ? it->Prev() : it->Next();
+            if(converted) {
+                if(scan->remaining > 0) {
+                    scan->remaining--;
                 }
+                return true;
             }
+        }
+        assert(it->status().ok());  // Check for any errors found during the scan
+        if(scan->trailingIndex < scan->trailing.size()) {
+            element = std::move(scan->trailing.at(scan->trailingIndex++));
+            return true;
+        }
+        return false;
+    }, keepAlive(session), completion, this->responseCache->maxResponseSize());
+}
 
-            if(raw == 0) {
-                txoObj["txhash"] = txo.substr(0,64);
-            }
-            if(txHashOnly == 0 && raw == 0) {
-                txoObj["vout"] = stoll(txo.substr(64,8));
-                txoObj["value"] = stoll(txo.substr(80));
-            }
+void VtcBlockIndexer::HttpServer::addressUtxos( const shared_ptr< Session > session )
+{
+    const auto request = session->get_request( );
+    string address = request->get_path_parameter( "address" );
 
-            j.push_back(txoObj);
+    const string key = cacheKey(session);
+    const uint64_t version = this->changeCounters->address(address);
+    if(respondCached(session, key, version)) {
+        return;
+    }
+
+    shared_ptr<ScanState> scan = make_shared<ScanState>();
+    scan->readOptions = snapshotReadOptions(scan->snapshot);
+
+    cout << "Fetching unspent txos for address " << address << endl;
+
+    // Confirmed outputs that are already spent by a mempool transaction are left out
+    shared_ptr<unordered_set<string>> mempoolSpent = make_shared<unordered_set<string>>(mempoolSpentOutpoints(address));
+    scan->trailing = mempoolUtxos(address);
+
+    scan->start = address + "-utxo-";
+    scan->limit = address + "-utxo-~";
+    scan->it.reset(newScanIterator(scan->readOptions));
+    scan->it->Seek(scan->start);
+
+    size_t prefixSize = scan->start.size();
+    multimap<string, string> headers = { { "Content-Type",  "application/json" }, { "ETag", etag(version) } };
+    streamScan(session, headers, scan, [mempoolSpent, prefixSize](leveldb::Iterator* it, json& txoObj) {
+        // Key ends with <txid><vout>, value is <height><value>
+        string outpoint = it->key().ToString().substr(prefixSize);
+        if(mempoolSpent->find(outpoint) != mempoolSpent->end()) {
+            return false;
         }
+        txoObj = utxoJson(outpoint, it->value().ToString());
+        return true;
+    }, cacheStream(key, version, headers));
+}
+
+json VtcBlockIndexer::HttpServer::utxoJson(const string& outpoint, const string& utxo)
+{
+    json txoObj;
+    txoObj["txhash"] = outpoint.substr(0,64);
+    txoObj["vout"] = stoll(outpoint.substr(64,8));
+    txoObj["value"] = stoll(utxo.substr(8,16));
+    txoObj["height"] = stoll(utxo.substr(0,8));
+    return txoObj;
+}
+
+unordered_set<string> VtcBlockIndexer::HttpServer::mempoolSpentOutpoints(const string& address)
+{
+    unordered_set<string> outpoints;
+    for (const VtcBlockIndexer::TransactionOutput& txo : mempoolMonitor->getSpentTxos(address)) {
+        outpoints.insert(VtcBlockIndexer::Keys::utxo(txo.txHash, txo.index).str());
     }
-    assert(it->status().ok());  // Check for any errors found during the scan
-    delete it;
+    return outpoints;
+}
 
-    // Add mempool transactions
-    vector<VtcBlockIndexer::TransactionOutput> mempoolOutputs = mempoolMonitor->getTxos(request->get_path_parameter( "address" ));
-    for (VtcBlockIndexer::TransactionOutput txo : mempoolOutputs) {
+vector<json> VtcBlockIndexer::HttpServer::mempoolUtxos(const string& address)
+{
+    vector<json> utxos;
+    for (const VtcBlockIndexer::TransactionOutput& txo : mempoolMonitor->getTxos(address)) {
+        if(mempoolMonitor->outpointSpend(txo.txHash, txo.index).compare("") != 0) {
+            continue;
+        }
         json txoObj;
         txoObj["txhash"] = txo.txHash;
         txoObj["vout"] = txo.index;
         txoObj["value"] = txo.value;
-        txoObj["block"] = 0;
+        txoObj["height"] = 0;
+        utxos.push_back(txoObj);
+    }
+    return utxos;
+}
+
+long long VtcBlockIndexer::HttpServer::mempoolBalanceChange(const string& address)
+{
+    long long change = 0;
+
+    // Deduct confirmed TXOs that are spent in the mempool
+    for (const VtcBlockIndexer::TransactionOutput& txo : mempoolMonitor->getSpentTxos(address)) {
+        change -= txo.value;
+    }
+
+    // Add mempool TXOs that aren't spent again
+    for (const VtcBlockIndexer::TransactionOutput& txo : mempoolMonitor->getTxos(address)) {
+        if(mempoolMonitor->outpointSpend(txo.txHash, txo.index).compare("") == 0) {
+            change += txo.value;
+        }
+    }
+    return change;
+}
+
+vector<json> VtcBlockIndexer::HttpServer::mempoolTxos(const string& address)
+{
+    vector<json> txos;
+    vector<VtcBlockIndexer::TransactionOutput> mempoolOutputs = mempoolMonitor->getTxos(address);
+    for (const VtcBlockIndexer::TransactionOutput& txo : mempoolOutputs) {
+        json txoObj;
+        txoObj["txhash"] = txo.txHash;
+        txoObj["vout"] = txo.index;
+        txoObj["value"] = txo.value;
+        txoObj["height"] = 0;
         string spender = mempoolMonitor->outpointSpend(txo.txHash, txo.index);
         if(spender.compare("") != 0) {
             txoObj["spender"] = spender;
         } else {
             txoObj["spender"] = nullptr;
         }
-        j.push_back(txoObj);
+        txos.push_back(txoObj);
     }
-
-    string body = j.dump();
-     
-    session->close( OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
+    return txos;
 }
 
 void VtcBlockIndexer::HttpServer::outpointSpend( const shared_ptr< Session > session )
 {
+    shared_ptr<const leveldb::Snapshot> snapshot;
+    leveldb::ReadOptions readOptions = snapshotReadOptions(snapshot);
     json j;
     j["error"] = false;
     const auto request = session->get_request( );
 
     long long vout = stoll(request->get_path_parameter( "vout", "0" ));
     string txid = request->get_path_parameter("txid", "");
-    stringstream txBlockKey;
-    string txBlock;
-    txBlockKey << "tx-" << txid << "-block";
-    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), txBlockKey.str(), &txBlock);
+    string txLocation;
+    leveldb::Status s = this->db->Get(readOptions, VtcBlockIndexer::Keys::tx(txid).slice(), &txLocation);
     if(!s.ok()) {
         j["error"] = true;
         j["errorDescription"] = "Transaction ID not found";
     }
     else 
     {
-        stringstream txoId;
-        txoId << "txo-" << txid << "-" << setw(8) << setfill('0') << vout << "-spent";
+        VtcBlockIndexer::KeyBuilder txoId = VtcBlockIndexer::Keys::txoSpent(txid, vout);
         cout << "Checking outpoint spent " << txoId.str() << endl;
         string spentTx;
 
-        s = this->db->Get(leveldb::ReadOptions(), txoId.str(), &spentTx);
+        s = this->db->Get(readOptions, txoId.slice(), &spentTx);
         j["spent"] = s.ok();
         if(s.ok()) {
             j["spender"] = spentTx.substr(65, 64);
@@ -400,7 +841,7 @@ void VtcBlockIndexer::HttpServer::outpointSpend( const shared_ptr< Session > ses
    
     string body = j.dump();
      
-    session->close( OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
+    respond( session, OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
 } 
 
 
@@ -411,55 +852,60 @@ void VtcBlockIndexer::HttpServer::outpointSpends( const shared_ptr< Session > se
     content_length = request->get_header( "Content-Length", 0);
     session->fetch( content_length, [ request, this ]( const shared_ptr< Session > session, const Bytes & body )
     {
+        shared_ptr<const leveldb::Snapshot> snapshot;
+        leveldb::ReadOptions readOptions = snapshotReadOptions(snapshot);
         string content =string(body.begin(), body.end());
-        json output = json::array();
         json input = json::parse(content);
-        if(!input.is_null()) {
+
+        // Collect the valid outpoints and their keys first: the location of
+        // the transaction followed by the spent record, two keys per outpoint
+        struct OutpointLookup {
+            vector<pair<string, int>> outpoints;
+            vector<bool> found;
+            vector<string> values;
+            size_t next = 0;
+        };
+        shared_ptr<OutpointLookup> lookup = make_shared<OutpointLookup>();
+        vector<string> keys;
+        if(input.is_array()) {
             for (auto& txo : input) {
                 if(txo.is_object() && txo["txid"].is_string() && txo["vout"].is_number()) {
-                    stringstream txoId;
-                    txoId << "txo-" << txo["txid"].get<string>() << "-" << setw(8) << setfill('0') << txo["vout"].get<int>() << "-spent";
-                    cout << "Checking outpoint spent " << txoId.str() << endl;
-            
-                    json j;
-                    j["txid"] = txo["txid"];
-                    j["vout"] = txo["vout"];
-                    j["error"] = false;
-                    stringstream txBlockKey;
-                    string txBlock;
-                    txBlockKey << "tx-" << txo["txid"].get<string>() << "-block";
-                    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), txBlockKey.str(), &txBlock);
-                    if(!s.ok()) {
-                        j["error"] = true;
-                        j["errorDescription"] = "Transaction ID not found";
-                    }
-                    else 
-                    {
-                        string spentTx;
-                        s = this->db->Get(leveldb::ReadOptions(), txoId.str(), &spentTx);
-                        if(s.ok()) {
-                            j["spender"] = spentTx.substr(65, 64);
-                            j["spent"] = true;
-                        } else {
-                            string mempoolSpend = mempoolMonitor->outpointSpend( txo["txid"].get<string>(), txo["vout"].get<int>());
-                            if(mempoolSpend.compare("") != 0) {
-                                json j;
-                                j["spender"] = mempoolSpend;
-                                j["spent"] = true;
-                            } else {
-                                j["spent"] = false;
-                            }
-                        }
-                    }
-
-                    output.push_back(j);
-                    
+                    lookup->outpoints.push_back(make_pair(txo["txid"].get<string>(), txo["vout"].get<int>()));
+                    keys.push_back(VtcBlockIndexer::Keys::tx(lookup->outpoints.back().first).str());
+                    keys.push_back(VtcBlockIndexer::Keys::txoSpent(lookup->outpoints.back().first, lookup->outpoints.back().second).str());
                 }
             }
         }
-    
-        string resultBody = output.dump();
-        session->close( OK, resultBody, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(resultBody.size()) } } );
+        cout << "Checking " << lookup->outpoints.size() << " outpoints spent" << endl;
+
+        VtcBlockIndexer::BatchLookup::get(this->db, readOptions, keys, lookup->found, lookup->values);
+
+        VtcBlockIndexer::JsonArrayStream::send(session, { { "Content-Type",  "application/json" } }, [this, lookup](json& j) {
+            if(lookup->next == lookup->outpoints.size()) {
+                return false;
+            }
+            size_t i = lookup->next++;
+            const pair<string, int>& txo = lookup->outpoints.at(i);
+            j["txid"] = txo.first;
+            j["vout"] = txo.second;
+            j["error"] = false;
+            if(!lookup->found.at(i * 2)) {
+                j["error"] = true;
+                j["errorDescription"] = "Transaction ID not found";
+            } else if(lookup->found.at(i * 2 + 1)) {
+                j["spender"] = lookup->values.at(i * 2 + 1).substr(65, 64);
+                j["spent"] = true;
+            } else {
+                string mempoolSpend = mempoolMonitor->outpointSpend(txo.first, txo.second);
+                if(mempoolSpend.compare("") != 0) {
+                    j["spender"] = mempoolSpend;
+                    j["spent"] = true;
+                } else {
+                    j["spent"] = false;
+                }
+            }
+            return true;
+        }, keepAlive(session));
     } );
 } 
 
@@ -469,28 +915,13 @@ void VtcBlockIndexer::HttpServer::outpointSpends( const shared_ptr< Session > se
 void VtcBlockIndexer::HttpServer::eSignatureTransactions( const shared_ptr< Session > session )
 {
     const auto request = session->get_request( );
-    json output = json::array();
     string dir = request->get_path_parameter("dir", "");
     string address = request->get_path_parameter("addr", "");
-    
-    string start("esign-" + dir + "-" + address + "-00000001");
-    string limit("esign-" + dir + "-" + address + "-99999999");
-    
-   
-    leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
-    
-    for (it->Seek(start);
-            it->Valid() && it->key().ToString() < limit;
-            it->Next()) {
-        string data = it->value().ToString();
-        json j;
-        j["address"] = data.substr(0,34);
-        j["txid"] = data.substr(34,64);
-        j["height"] = stoll(data.substr(98,12));
-        j["time"] = stoll(data.substr(110,12));
-        j["script"] = data.substr(122);
-        output.push_back(j);
 
+    const string key = cacheKey(session);
+    const uint64_t version = this->changeCounters->address(address);
+    if(respondCached(session, key, version)) {
+        return;
     }
 
     vector<EsignatureTransaction> mempoolTransactions = {};
@@ -499,64 +930,54 @@ void VtcBlockIndexer::HttpServer::eSignatureTransactions( const shared_ptr< Sess
     } else {
         mempoolTransactions = this->mempoolMonitor->getEsignTransactionsFrom(address);
     }
-    for(EsignatureTransaction tx : mempoolTransactions) {
-        json j;
-        if(dir.compare("in") == 0) { 
-            j["address"] = tx.fromAddress;
-        } else {
-            j["address"] = tx.toAddress;
-        }
-        j["txid"] = tx.txId;
-        j["height"] = tx.height;
-        j["time"] = tx.time;
-        j["script"] = VtcBlockIndexer::Utility::hashToHex(tx.script);
-        output.push_back(j);
-    }
 
-    string resultBody = output.dump();
-    session->close( OK, resultBody, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(resultBody.size()) } } );
+    streamDetectedTransactions(session, "esign-" + dir + "-" + address, mempoolTransactions, dir.compare("in") == 0, key, version);
 } 
 
 void VtcBlockIndexer::HttpServer::identityTransactions( const shared_ptr< Session > session )
 {
     const auto request = session->get_request( );
-    json output = json::array();
     string address = request->get_path_parameter("addr", "");
-    
-    string start("ident-" + address + "-00000001");
-    string limit("ident-" + address + "-99999999");
-    
-    leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
-    
-    for (it->Seek(start);
-            it->Valid() && it->key().ToString() < limit;
-            it->Next()) {
-        string data = it->value().ToString();
-        json j;
-        j["address"] = data.substr(0,34);
-        j["txid"] = data.substr(34,64);
-        j["height"] = stoll(data.substr(98,12));
-        j["time"] = stoll(data.substr(110,12));
-        j["script"] = data.substr(122);
-        output.push_back(j);
 
+    const string key = cacheKey(session);
+    const uint64_t version = this->changeCounters->address(address);
+    if(respondCached(session, key, version)) {
+        return;
     }
 
-    vector<IdentityTransaction> mempoolTransactions = this->mempoolMonitor->getIdentityTransactions(address);
-    
-    for(IdentityTransaction tx : mempoolTransactions) {
+    streamDetectedTransactions(session, "ident-" + address, this->mempoolMonitor->getIdentityTransactions(address), true, key, version);
+} 
+
+void VtcBlockIndexer::HttpServer::streamDetectedTransactions(const shared_ptr<Session>& session, const string& prefix, const vector<VtcBlockIndexer::DetectedTransaction>& mempoolTransactions, bool fromAddress, const string& key, uint64_t version)
+{
+    shared_ptr<ScanState> scan = make_shared<ScanState>();
+    scan->readOptions = snapshotReadOptions(scan->snapshot);
+    scan->start = prefix + "-00000001";
+    scan->limit = prefix + "-99999999";
+
+    for(const VtcBlockIndexer::DetectedTransaction& tx : mempoolTransactions) {
         json j;
-        j["address"] = tx.fromAddress;
+        j["address"] = fromAddress ? tx.fromAddress : tx.toAddress;
         j["txid"] = tx.txId;
         j["height"] = tx.height;
         j["time"] = tx.time;
         j["script"] = VtcBlockIndexer::Utility::hashToHex(tx.script);
-        output.push_back(j);
+        scan->trailing.push_back(j);
     }
 
-    string resultBody = output.dump();
-    session->close( OK, resultBody, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(resultBody.size()) } } );
-} 
+    scan->it.reset(newScanIterator(scan->readOptions));
+    scan->it->Seek(scan->start);
+    multimap<string, string> headers = { { "Content-Type",  "application/json" }, { "ETag", etag(version) } };
+    streamScan(session, headers, scan, [](leveldb::Iterator* it, json& j) {
+        string data = it->value().ToString();
+        j["address"] = data.substr(0,34);
+        j["txid"] = data.substr(34,64);
+        j["height"] = stoll(data.substr(98,12));
+        j["time"] = stoll(data.substr(110,12));
+        j["script"] = data.substr(122);
+        return true;
+    }, cacheStream(key, version, headers));
+}
 
 void VtcBlockIndexer::HttpServer::sendRawTransaction( const shared_ptr< Session > session )
 {
@@ -567,16 +988,299 @@ void VtcBlockIndexer::HttpServer::sendRawTransaction( const shared_ptr< Session
         const string rawtx = string(body.begin(), body.end());
         
         try {
-            const auto txid = vertcoind->sendrawtransaction(rawtx);
+            const auto txid = vertcoin().sendrawtransaction(rawtx);
             
-            session->close(OK, txid, {{"Content-Type","text/plain"}, {"Content-Length",  std::to_string(txid.size())}});
+            respond(session, OK, txid, {{"Content-Type","text/plain"}, {"Content-Length",  std::to_string(txid.size())}});
         } catch(const jsonrpc::JsonRpcException& e) {
             const std::string message(e.what());
-            session->close(400, message, {{"Content-Type","text/plain"},{"Content-Length",  std::to_string(message.size())}});
+            respond(session, 400, message, {{"Content-Type","text/plain"},{"Content-Length",  std::to_string(message.size())}});
         }
     });
 } 
 
+bool VtcBlockIndexer::HttpServer::readAddressList(const shared_ptr<Session>& session, const Bytes& body, vector<string>& addresses)
+{
+    json input = json::parse(string(body.begin(), body.end()), nullptr, false);
+    string error;
+    if(input.is_discarded() || !input.is_array()) {
+        error = "Expected a JSON array of addresses";
+    } else if(input.size() > maxBatchAddresses) {
+        error = "At most " + std::to_string(maxBatchAddresses) + " addresses per request";
+    } else {
+        unordered_set<string> seen;
+        for(auto& address : input) {
+            if(!address.is_string()) {
+                error = "Expected a JSON array of addresses";
+                break;
+            }
+            if(seen.insert(address.get<string>()).second) {
+                addresses.push_back(address.get<string>());
+            }
+        }
+    }
+
+    if(!error.empty()) {
+        respond(session, 400, error, {{"Content-Type","text/plain"},{"Content-Length",  std::to_string(error.size())}});
+        return false;
+    }
+    return true;
+}
+
+void VtcBlockIndexer::HttpServer::batchAddressBalance( const shared_ptr< Session > session )
+{
+    const auto request = session->get_request( );
+    size_t content_length = request->get_header( "Content-Length", 0);
+    session->fetch( content_length, [ this ]( const shared_ptr< Session > session, const Bytes & body )
+    {
+        vector<string> addresses;
+        if(!readAddressList(session, body, addresses)) {
+            return;
+        }
+        cout << "Checking balance for " << addresses.size() << " addresses" << endl;
+
+        shared_ptr<const leveldb::Snapshot> snapshot;
+        leveldb::ReadOptions readOptions = snapshotReadOptions(snapshot);
+
+        // The balance records are point reads, one pass over the sorted keys
+        // resolves them all
+        vector<string> keys;
+        for(const string& address : addresses) {
+            keys.push_back(address + "-balance");
+        }
+        vector<bool> found;
+        vector<string> values;
+        VtcBlockIndexer::BatchLookup::get(this->db, readOptions, keys, found, values);
+
+        json j = json::object();
+        for(size_t i = 0; i < addresses.size(); i++) {
+            VtcBlockIndexer::AddressBalance confirmed = VtcBlockIndexer::Utility::decodeAddressBalance(found.at(i) ? values.at(i) : "");
+            j[addresses.at(i)] = (long long)(confirmed.received - confirmed.spent) + mempoolBalanceChange(addresses.at(i));
+        }
+
+        const string response = j.dump();
+        respond(session, OK, response, {{"Content-Type","application/json"},{"Content-Length",  std::to_string(response.size())}});
+    } );
+}
+
+void VtcBlockIndexer::HttpServer::batchAddressTxos( const shared_ptr< Session > session )
+{
+    const auto request = session->get_request( );
+    // The numeric parameters are checked up front, stoll would throw on them
+    for(const string name : {"sinceBlock", "txHashOnly", "raw", "limit"}) {
+        const string value = request->get_query_parameter(name, "0");
+        if(value.empty() || value.size() > 18 || !all_of(value.begin(), value.end(), [](char c) { return isdigit((unsigned char)c); })) {
+            const string message = "Invalid " + name;
+            respond(session, 400, message, {{"Content-Type","text/plain"},{"Content-Length",  std::to_string(message.size())}});
+            return;
+        }
+    }
+    long long sinceBlock = stoll(request->get_query_parameter("sinceBlock","0"));
+    bool txHashOnly = stoll(request->get_query_parameter("txHashOnly","0")) != 0;
+    bool raw = stoll(request->get_query_parameter("raw","0")) != 0;
+    bool merge = (request->get_query_parameter("merge","0").compare("1") == 0);
+    long long pageSize = stoll(request->get_query_parameter("limit","0"));
+    if(pageSize <= 0 || pageSize > maxBatchTxoPageSize) {
+        pageSize = maxBatchTxoPageSize;
+    }
+
+    size_t content_length = request->get_header( "Content-Length", 0);
+    session->fetch( content_length, [ this, sinceBlock, txHashOnly, raw, merge, pageSize ]( const shared_ptr< Session > session, const Bytes & body )
+    {
+        vector<string> addresses;
+        if(!readAddressList(session, body, addresses)) {
+            return;
+        }
+        cout << "Fetching address txos for " << addresses.size() << " addresses" << endl;
+
+        // All addresses are read from the same snapshot, each on its own iterator
+        shared_ptr<const leveldb::Snapshot> snapshot;
+        leveldb::ReadOptions readOptions = snapshotReadOptions(snapshot);
+        vector<vector<json>> txos(addresses.size());
+        vector<vector<string>> positions(addresses.size());
+        vector<string> nextCursors(addresses.size());
+        this->lookupPool->parallelFor(addresses.size(), 1, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                txos.at(i) = collectTxos(addresses.at(i), readOptions, sinceBlock, pageSize, raw, txHashOnly, positions.at(i), nextCursors.at(i));
+            }
+        });
+
+        // Addresses with more history than the page return a cursor to continue
+        // with on addressTxos
+        json j = json::object();
+        if(merge) {
+            // Every address has all of its history up to the lowest height a
+            // truncated page ended at, except the page that ended there, which
+            // continues from its own cursor. The merged history stops at that
+            // height, so it always includes the whole of that page.
+            long long cutHeight = LLONG_MAX;
+            for(size_t i = 0; i < addresses.size(); i++) {
+                if(!nextCursors.at(i).empty()) {
+                    cutHeight = min(cutHeight, txos.at(i).back()["height"].get<long long>());
+                }
+            }
+
+            // Addresses with nothing up to the cut continue after it
+            string cutCursor;
+            if(cutHeight != LLONG_MAX) {
+                const string position = VtcBlockIndexer::KeyBuilder().appendNumber<VtcBlockIndexer::KeyWidth::Height>(cutHeight).append("-", 1).appendNumber<VtcBlockIndexer::KeyWidth::Index>(99999999).str();
+                cutCursor = VtcBlockIndexer::KeyBuilder().appendHex((const unsigned char*)position.data(), position.size()).str();
+            }
+
+            json cursors = json::object();
+            vector<json> history;
+            vector<json> unconfirmed;
+            for(size_t i = 0; i < addresses.size(); i++) {
+                bool complete = nextCursors.at(i).empty();
+                string cursor = cutCursor;
+                for(size_t t = 0; t < txos.at(i).size(); t++) {
+                    json& txo = txos.at(i).at(t);
+                    if(txo["height"].get<long long>() > cutHeight) {
+                        complete = false;
+                        break;
+                    }
+                    txo["address"] = addresses.at(i);
+                    history.push_back(std::move(txo));
+                    cursor = positions.at(i).at(t);
+                }
+                if(complete) {
+                    for(json& txo : mempoolTxos(addresses.at(i))) {
+                        txo["address"] = addresses.at(i);
+                        unconfirmed.push_back(std::move(txo));
+                    }
+                } else {
+                    cursors[addresses.at(i)] = cursor;
+                }
+            }
+
+            // Unconfirmed TXOs have height 0 and go last
+            stable_sort(history.begin(), history.end(), [](const json& a, const json& b) {
+                return a["height"].get<long long>() < b["height"].get<long long>();
+            });
+            history.insert(history.end(), unconfirmed.begin(), unconfirmed.end());
+            j["txos"] = history;
+            j["nextCursors"] = cursors;
+        } else {
+            for(size_t i = 0; i < addresses.size(); i++) {
+                json result;
+                if(nextCursors.at(i).empty()) {
+                    vector<json> mempool = mempoolTxos(addresses.at(i));
+                    txos.at(i).insert(txos.at(i).end(), mempool.begin(), mempool.end());
+                }
+                result["txos"] = txos.at(i);
+                if(nextCursors.at(i).empty()) {
+                    result["nextCursor"] = nullptr;
+                } else {
+                    result["nextCursor"] = nextCursors.at(i);
+                }
+                j[addresses.at(i)] = result;
+            }
+        }
+
+        const string response = j.dump();
+        respond(session, OK, response, {{"Content-Type","application/json"},{"Content-Length",  std::to_string(response.size())}});
+    } );
+}
+
+void VtcBlockIndexer::HttpServer::batchAddressUtxos( const shared_ptr< Session > session )
+{
+    const auto request = session->get_request( );
+    size_t content_length = request->get_header( "Content-Length", 0);
+    session->fetch( content_length, [ this ]( const shared_ptr< Session > session, const Bytes & body )
+    {
+        vector<string> addresses;
+        if(!readAddressList(session, body, addresses)) {
+            return;
+        }
+        cout << "Fetching unspent txos for " << addresses.size() << " addresses" << endl;
+
+        shared_ptr<const leveldb::Snapshot> snapshot;
+        leveldb::ReadOptions readOptions = snapshotReadOptions(snapshot);
+        vector<vector<json>> utxos(addresses.size());
+        this->lookupPool->parallelFor(addresses.size(), 1, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                utxos.at(i) = collectUtxos(addresses.at(i), readOptions);
+            }
+        });
+
+        json j = json::object();
+        for(size_t i = 0; i < addresses.size(); i++) {
+            j[addresses.at(i)] = utxos.at(i);
+        }
+
+        const string response = j.dump();
+        respond(session, OK, response, {{"Content-Type","application/json"},{"Content-Length",  std::to_string(response.size())}});
+    } );
+}
+
+void VtcBlockIndexer::HttpServer::events( const shared_ptr< Session > session )
+{
+    const auto request = session->get_request( );
+    bool blocks = (request->get_query_parameter("blocks","0").compare("1") == 0);
+
+    // Addresses are passed comma separated
+    vector<string> addresses;
+    unordered_set<string> seen;
+    stringstream addressList(request->get_query_parameter("addresses",""));
+    string address;
+    while(getline(addressList, address, ',')) {
+        if(!address.empty() && seen.insert(address).second) {
+            addresses.push_back(address);
+        }
+    }
+
+    if(addresses.size() > maxBatchAddresses || (addresses.empty() && !blocks)) {
+        const string message = addresses.empty() ? "Subscribe to blocks=1 and/or a list of addresses" : "At most " + std::to_string(maxBatchAddresses) + " addresses per subscription";
+        respond(session, 400, message, {{"Content-Type","text/plain"},{"Content-Length",  std::to_string(message.size())}});
+        return;
+    }
+
+    cout << "Subscribing to events for " << addresses.size() << " addresses" << (blocks ? " and blocks" : "") << endl;
+    this->eventBroadcaster->subscribe(session, addresses, blocks);
+}
+
+vector<json> VtcBlockIndexer::HttpServer::collectTxos(const string& address, const leveldb::ReadOptions& readOptions, long long sinceBlock, size_t limit, bool raw, bool txHashOnly, vector<string>& positions, string& nextCursor)
+{
+    vector<json> txos;
+    const size_t positionSize = VtcBlockIndexer::Keys::addressTxoSuffixSize - 5;
+    const string limitKey = address + "-txo-~";
+
+    unique_ptr<leveldb::Iterator> it(newScanIterator(readOptions));
+    for (it->Seek(VtcBlockIndexer::Keys::addressTxoFrom(address, sinceBlock).slice());
+            it->Valid() && it->key().compare(limitKey) < 0;
+            it->Next()) {
+        if(txos.size() == limit) {
+            nextCursor = positions.back();
+            break;
+        }
+        txos.push_back(txoJson(it->value().ToString(), readOptions, raw, txHashOnly));
+        const string position = it->key().ToString().substr(it->key().size() - positionSize);
+        positions.push_back(VtcBlockIndexer::KeyBuilder().appendHex((const unsigned char*)position.data(), position.size()).str());
+    }
+    assert(it->status().ok());  // Check for any errors found during the scan
+    return txos;
+}
+
+vector<json> VtcBlockIndexer::HttpServer::collectUtxos(const string& address, const leveldb::ReadOptions& readOptions)
+{
+    vector<json> utxos;
+    unordered_set<string> mempoolSpent = mempoolSpentOutpoints(address);
+    const string start = address + "-utxo-";
+    const string limit = address + "-utxo-~";
+
+    unique_ptr<leveldb::Iterator> it(newScanIterator(readOptions));
+    for (it->Seek(start); it->Valid() && it->key().compare(limit) < 0; it->Next()) {
+        string outpoint = it->key().ToString().substr(start.size());
+        if(mempoolSpent.find(outpoint) == mempoolSpent.end()) {
+            utxos.push_back(utxoJson(outpoint, it->value().ToString()));
+        }
+    }
+    assert(it->status().ok());  // Check for any errors found during the scan
+
+    vector<json> mempool = mempoolUtxos(address);
+    utxos.insert(utxos.end(), mempool.begin(), mempool.end());
+    return utxos;
+}
+
 void VtcBlockIndexer::HttpServer::run()
 {
     auto addressBalanceResource = make_shared< Resource >( );
@@ -591,6 +1295,10 @@ void VtcBlockIndexer::HttpServer::run()
     addressTxosSinceBlockResource->set_path( "/addressTxosSince/{sinceBlock: ^[0-9]*$}/{address: .*}" );
     addressTxosSinceBlockResource->set_method_handler( "GET", bind( &VtcBlockIndexer::HttpServer::addressTxos, this, std::placeholders::_1) );
     
+    auto addressUtxosResource = make_shared< Resource >( );
+    addressUtxosResource->set_path( "/addressUtxos/{address: .*}" );
+    addressUtxosResource->set_method_handler( "GET", bind( &VtcBlockIndexer::HttpServer::addressUtxos, this, std::placeholders::_1) );
+    
     auto getTransactionResource = make_shared<Resource>();
     getTransactionResource->set_path( "/getTransaction/{id: [0-9a-f]*}" );
     getTransactionResource->set_method_handler("GET", bind(&VtcBlockIndexer::HttpServer::getTransaction, this, std::placeholders::_1) );
@@ -621,6 +1329,22 @@ void VtcBlockIndexer::HttpServer::run()
    
 
 
+    auto batchAddressBalanceResource = make_shared<Resource>();
+    batchAddressBalanceResource->set_path( "/batch/addressBalance" );
+    batchAddressBalanceResource->set_method_handler("POST", bind(&VtcBlockIndexer::HttpServer::batchAddressBalance, this, std::placeholders::_1) );
+
+    auto batchAddressTxosResource = make_shared<Resource>();
+    batchAddressTxosResource->set_path( "/batch/addressTxos" );
+    batchAddressTxosResource->set_method_handler("POST", bind(&VtcBlockIndexer::HttpServer::batchAddressTxos, this, std::placeholders::_1) );
+
+    auto batchAddressUtxosResource = make_shared<Resource>();
+    batchAddressUtxosResource->set_path( "/batch/addressUtxos" );
+    batchAddressUtxosResource->set_method_handler("POST", bind(&VtcBlockIndexer::HttpServer::batchAddressUtxos, this, std::placeholders::_1) );
+
+    auto eventsResource = make_shared<Resource>();
+    eventsResource->set_path( "/events" );
+    eventsResource->set_method_handler("GET", bind(&VtcBlockIndexer::HttpServer::events, this, std::placeholders::_1) );
+
     auto blocksResource = make_shared<Resource>();
     blocksResource->set_path( "/blocks" );
     blocksResource->set_method_handler("GET", bind(&VtcBlockIndexer::HttpServer::getBlocks, this, std::placeholders::_1) );
@@ -632,12 +1356,21 @@ void VtcBlockIndexer::HttpServer::run()
 
     auto settings = make_shared< Settings >( );
     settings->set_port( 8888 );
-    settings->set_default_header( "Connection", "close" );
+    settings->set_default_header( "Connection", "keep-alive" );
+
+    // Handlers run on a pool of workers, HTTP_WORKERS overrides its size
+    unsigned int workers = std::thread::hardware_concurrency();
+    const char* workersEnv = std::getenv("HTTP_WORKERS");
+    if(workersEnv != NULL && atoi(workersEnv) > 0) {
+        workers = atoi(workersEnv);
+    }
+    settings->set_worker_limit( workers > 0 ? workers : 4 );
 
     Service service;
     service.publish( addressBalanceResource );
     service.publish( addressTxosResource );
     service.publish( addressTxosSinceBlockResource );
+    service.publish( addressUtxosResource );
     service.publish( getTransactionResource );
     service.publish( getTransactionProofResource );
     service.publish( outpointSpendResource );
@@ -645,7 +1378,17 @@ void VtcBlockIndexer::HttpServer::run()
     service.publish( sendRawTransactionResource );
     service.publish( eSignatureTransactionsResource );
     service.publish( identityTransactionsResource );
+    service.publish( batchAddressBalanceResource );
+    service.publish( batchAddressTxosResource );
+    service.publish( batchAddressUtxosResource );
+    service.publish( eventsResource );
     service.publish( blocksResource );
     service.publish( syncResource );
+
+    // Collected changes are pushed to the event subscribers every second
+    VtcBlockIndexer::EventBroadcaster* eventBroadcaster = this->eventBroadcaster.get();
+    service.schedule([eventBroadcaster]() {
+        eventBroadcaster->flush();
+    }, std::chrono::milliseconds(1000));
     service.start( settings );
 }
@@ -1,5 +1,6 @@
 #include <fstream>
 #include <vector>
+#include <unordered_set>
 
 /*  VTC Blockindexer - A utility to build additional indexes to the 
     Vertcoin blockchain by scanning and indexing the blockfiles
@@ -31,6 +32,15 @@
 #include "blockreader.h"
 #include "scriptsolver.h"
 #include "mempoolmonitor.h"
+#include "chainsnapshot.h"
+#include "blocksummaryfile.h"
+#include "blockfilecache.h"
+#include "changecounters.h"
+#include "responsecache.h"
+#include "workerpool.h"
+#include "eventbroadcaster.h"
+#include "json.hpp"
+#include "jsonarraystream.h"
 
 using namespace std;
 using namespace restbed;
@@ -45,13 +55,16 @@ namespace VtcBlockIndexer {
     
     class HttpServer {
         public:
-            HttpServer(leveldb::DB* dbInstance, VtcBlockIndexer::MempoolMonitor* mempoolMonitor, std::string blocksDir);
+            HttpServer(leveldb::DB* dbInstance, VtcBlockIndexer::MempoolMonitor* mempoolMonitor, VtcBlockIndexer::ChainSnapshot* chainSnapshot, VtcBlockIndexer::ChangeCounters* changeCounters, VtcBlockIndexer::BlockSummaryFile* blockSummaries, std::string blocksDir);
             void run();
             /* REST Api for returning the balance of a given address */
             void addressBalance( const shared_ptr< Session > session );
 
             /* REST Api for returning the TXOs on a given address */
             void addressTxos( const shared_ptr< Session > session );
+
+            /* REST Api for returning the unspent TXOs on a given address */
+            void addressUtxos( const shared_ptr< Session > session );
             
             /* REST Api for returning the transaction details with a given hash */
             void getTransaction(const shared_ptr<Session> session);
@@ -76,12 +89,163 @@ namespace VtcBlockIndexer {
 
             /* REST Api for sending a hex transaction on the VTC p2p network*/
             void sendRawTransaction( const shared_ptr< Session > session );
+
+            /* REST Api for returning the balances of a list of addresses */
+            void batchAddressBalance( const shared_ptr< Session > session );
+
+            /* REST Api for returning the TXOs of a list of addresses, per address
+               or merged into one history. A merged history ends at the lowest
+               height a truncated address page ended at, and every address it
+               doesn't complete gets its own cursor to continue with. */
+            void batchAddressTxos( const shared_ptr< Session > session );
+
+            /* REST Api for returning the unspent TXOs of a list of addresses */
+            void batchAddressUtxos( const shared_ptr< Session > session );
+
+            /* Server-Sent Events stream of new blocks and of activity on a list
+               of addresses */
+            void events( const shared_ptr< Session > session );
             
         private:
+            /* Returns read options for the last published chain snapshot, so all
+               reads of a request see the same committed blocks. The passed pointer
+               keeps the snapshot alive. */
+            leveldb::ReadOptions snapshotReadOptions(shared_ptr<const leveldb::Snapshot>& snapshot);
+
+            /* Returns an iterator for a range scan on the snapshot of the read
+               options. Scanned blocks aren't added to the block cache, so a long
+               address history doesn't push out the records of point lookups. */
+            leveldb::Iterator* newScanIterator(const leveldb::ReadOptions& readOptions);
+
+            /* Returns the vertcoind RPC client of the calling worker thread */
+            VertcoinClient& vertcoin();
+
+            /* Returns false when the client asked to close the connection after the response */
+            bool keepAlive(const shared_ptr<Session>& session);
+
+            /* Sends a response. The connection is kept open for the next request
+               unless the client asked to close it. */
+            void respond(const shared_ptr<Session>& session, int status, const std::string& body, const std::multimap<std::string, std::string>& headers);
+
+            /* Returns the key a response is cached under: the path and the
+               query parameters of the request */
+            std::string cacheKey(const shared_ptr<Session>& session);
+
+            /* Returns the ETag of a response built from a version of the data */
+            std::string etag(uint64_t version);
+
+            /* Answers the request without running its queries when possible:
+               with 304 when the client's If-None-Match has this version, or
+               with the response cached under the key for this version.
+               Returns false if the request still has to be handled. */
+            bool respondCached(const shared_ptr<Session>& session, const std::string& key, uint64_t version);
+
+            /* Sends a response with its ETag and caches it under the key */
+            void respondAndCache(const shared_ptr<Session>& session, const std::string& key, uint64_t version, int status, const std::string& body, const std::multimap<std::string, std::string>& headers);
+
+            /* Returns a completion that caches a streamed array under the key */
+            VtcBlockIndexer::JsonArrayStream::Completion cacheStream(const std::string& key, uint64_t version, const std::multimap<std::string, std::string>& headers);
+
+            /* A key range that is streamed to the client as a JSON array, with
+               elements that don't come from the database before or after it */
+            struct ScanState {
+                shared_ptr<const leveldb::Snapshot> snapshot;
+                leveldb::ReadOptions readOptions;
+
+                // Positioned at the first entry to send by the handler
+                std::unique_ptr<leveldb::Iterator> it;
+                std::string start;
+                std::string limit;
+                bool reverse = false;
+
+                // Number of entries left to send, -1 for the whole range
+                long long remaining = -1;
+
+                std::vector<nlohmann::json> leading;
+                std::vector<nlohmann::json> trailing;
+                size_t leadingIndex = 0;
+                size_t trailingIndex = 0;
+            };
+
+            /* Converts the entry the iterator points at to an array element.
+               Returns false to leave the entry out. */
+            typedef std::function<bool(leveldb::Iterator* it, nlohmann::json& element)> EntryConverter;
+
+            /* Streams the leading elements, the converted entries of the range
+               and the trailing elements as one JSON array */
+            void streamScan(const shared_ptr<Session>& session, const std::multimap<std::string, std::string>& headers, shared_ptr<ScanState> scan, EntryConverter convert, VtcBlockIndexer::JsonArrayStream::Completion completion = VtcBlockIndexer::JsonArrayStream::Completion());
+
+            /* Converts an address TXO record to its JSON form */
+            nlohmann::json txoJson(const std::string& txo, const leveldb::ReadOptions& readOptions, bool raw, bool txHashOnly);
+
+            /* Returns the unconfirmed TXOs of an address. Like the unconfirmed
+               UTXOs they have height 0. */
+            std::vector<nlohmann::json> mempoolTxos(const std::string& address);
+
+            /* Returns how much the mempool adds to the confirmed balance of an
+               address (negative when it spends more than it receives) */
+            long long mempoolBalanceChange(const std::string& address);
+
+            /* Returns the outpoints (txid + vout) of the confirmed TXOs of an
+               address that are spent in the mempool */
+            std::unordered_set<std::string> mempoolSpentOutpoints(const std::string& address);
+
+            /* Returns the unconfirmed TXOs of an address that aren't spent in
+               the mempool yet */
+            std::vector<nlohmann::json> mempoolUtxos(const std::string& address);
+
+            /* Converts an address UTXO record (outpoint from the key, height and
+               value from the value) to its JSON form */
+            static nlohmann::json utxoJson(const std::string& outpoint, const std::string& utxo);
+
+            /* Reads the address list posted to a batch endpoint. Returns false
+               and responds with an error if it's not a valid list. */
+            bool readAddressList(const shared_ptr<Session>& session, const Bytes& body, std::vector<std::string>& addresses);
+
+            /* Returns the first page (from sinceBlock upwards) of an address's
+               confirmed TXOs. positions receives the addressTxos cursor that
+               continues after each returned TXO. nextCursor receives the cursor
+               of the next page, it stays empty when the history fits in the page. */
+            std::vector<nlohmann::json> collectTxos(const std::string& address, const leveldb::ReadOptions& readOptions, long long sinceBlock, size_t limit, bool raw, bool txHashOnly, std::vector<std::string>& positions, std::string& nextCursor);
+
+            /* Returns the unspent TXOs of an address, including the mempool */
+            std::vector<nlohmann::json> collectUtxos(const std::string& address, const leveldb::ReadOptions& readOptions);
+
+            /* Streams the esignature or identity records under a key prefix,
+               followed by the matching transactions from the mempool, and
+               caches the response under the key */
+            void streamDetectedTransactions(const shared_ptr<Session>& session, const std::string& prefix, const std::vector<VtcBlockIndexer::DetectedTransaction>& mempoolTransactions, bool fromAddress, const std::string& key, uint64_t version);
+
+            /* Reads the summary of the block at a height from the block summary
+               file when its hash matches the block in the snapshot. Falls back to
+               the index otherwise, like while the indexer hasn't caught the file
+               up yet at startup or after a reorg. */
+            bool getBlockSummary(const leveldb::ReadOptions& readOptions, uint64_t height, VtcBlockIndexer::BlockSummary& summary);
+
+            /* Returns the hex of a transaction. Confirmed transactions are read
+               from the block files, only mempool transactions are requested from
+               vertcoind. Returns an empty string if the transaction is unknown. */
+            std::string rawTransactionHex(const std::string& txid, const leveldb::ReadOptions& readOptions);
+
+            /* Decodes a serialized transaction into the verbose JSON form of
+               vertcoind's getrawtransaction, without the block fields */
+            nlohmann::json decodeTransaction(const std::vector<unsigned char>& raw, bool testnet);
+
             leveldb::DB* db;
-            std::unique_ptr<VertcoinClient> vertcoind;
-            std::unique_ptr<jsonrpc::HttpClient> httpClient;
+            VtcBlockIndexer::ChainSnapshot* chainSnapshot;
+            VtcBlockIndexer::ChangeCounters* changeCounters;
+            std::unique_ptr<VtcBlockIndexer::ResponseCache> responseCache;
+            // Runs the per-address lookups of the batch endpoints in parallel
+            std::unique_ptr<VtcBlockIndexer::WorkerPool> lookupPool;
+            std::unique_ptr<VtcBlockIndexer::EventBroadcaster> eventBroadcaster;
+            // Keeps ETags from before a restart from matching, the counters
+            // start over
+            std::string etagPrefix;
+            VtcBlockIndexer::BlockSummaryFile* blockSummaries;
+            std::string vertcoindUrl;
+            // Opens the block file on every read, so the workers can share it
             VtcBlockIndexer::BlockReader blockReader;
+            std::unique_ptr<VtcBlockIndexer::BlockFileCache> blockFiles;
             VtcBlockIndexer::ScriptSolver scriptSolver;
             VtcBlockIndexer::MempoolMonitor* mempoolMonitor;
     /** Directory containing the blocks
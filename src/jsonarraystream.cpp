@@ -0,0 +1,100 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "jsonarraystream.h"
+#include <sstream>
+
+using namespace std;
+using namespace restbed;
+
+// Chunks are written once they hold at least this many bytes
+const size_t chunkSize = 16384;
+
+VtcBlockIndexer::JsonArrayStream::JsonArrayStream(Producer producer, bool keepAlive, Completion completion, size_t captureLimit) {
+    this->producer = producer;
+    this->keepAlive = keepAlive;
+    this->firstElement = true;
+    this->completion = completion;
+    this->captureLimit = captureLimit;
+}
+
+void VtcBlockIndexer::JsonArrayStream::send(const shared_ptr<Session>& session, multimap<string, string> headers, Producer producer, bool keepAlive, Completion completion, size_t captureLimit) {
+    shared_ptr<VtcBlockIndexer::JsonArrayStream> stream(new VtcBlockIndexer::JsonArrayStream(producer, keepAlive, completion, captureLimit));
+    headers.insert({ "Transfer-Encoding", "chunked" });
+    session->yield(OK, "", headers, [stream](const shared_ptr<Session> session) {
+        stream->writeChunk(session);
+    });
+}
+
+void VtcBlockIndexer::JsonArrayStream::writeChunk(const shared_ptr<Session>& session) {
+    if(session->is_closed()) {
+        return;
+    }
+
+    string buffer;
+    if(this->firstElement) {
+        buffer.push_back('[');
+    }
+
+    bool finished = false;
+    while(buffer.size() < chunkSize) {
+        nlohmann::json element;
+        if(!this->producer(element)) {
+            buffer.push_back(']');
+            finished = true;
+            break;
+        }
+        if(!this->firstElement) {
+            buffer.push_back(',');
+        }
+        this->firstElement = false;
+        buffer.append(element.dump());
+    }
+
+    if(this->completion) {
+        if(this->captured.size() + buffer.size() > this->captureLimit) {
+            // Too large to keep, give up on it
+            this->completion = Completion();
+            string().swap(this->captured);
+        } else {
+            this->captured.append(buffer);
+        }
+    }
+
+    stringstream data;
+    data << hex << buffer.size() << "\r\n" << buffer << "\r\n";
+    if(finished) {
+        // The last chunk is empty
+        data << "0\r\n\r\n";
+        if(this->keepAlive) {
+            session->yield(data.str());
+        } else {
+            session->close(data.str());
+        }
+        if(this->completion) {
+            this->completion(this->captured);
+        }
+        return;
+    }
+
+    shared_ptr<VtcBlockIndexer::JsonArrayStream> self = shared_from_this();
+    session->yield(data.str(), [self](const shared_ptr<Session> session) {
+        self->writeChunk(session);
+    });
+}
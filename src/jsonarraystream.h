@@ -0,0 +1,82 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef JSONARRAYSTREAM_H_INCLUDED
+#define JSONARRAYSTREAM_H_INCLUDED
+
+#include <string>
+#include <map>
+#include <memory>
+#include <functional>
+#include <restbed>
+#include "json.hpp"
+
+namespace VtcBlockIndexer {
+
+/**
+ * The JsonArrayStream class sends a JSON array as a chunked HTTP response.
+ * Elements are asked from a producer and written out in chunks as they come,
+ * so a handler can stream a database scan without holding the whole result.
+ * Every chunk is written asynchronously and the next one is produced from
+ * the write callback, on whichever worker restbed runs it.
+ */
+
+class JsonArrayStream : public std::enable_shared_from_this<JsonArrayStream> {
+public:
+    /** Fills in the next element of the array. Returns false when there are
+     * no more elements. */
+    typedef std::function<bool(nlohmann::json& element)> Producer;
+
+    /** Receives the complete array once it has been sent */
+    typedef std::function<void(const std::string& body)> Completion;
+
+    /** Sends a 200 response with the passed headers and streams the array
+     *
+     * @param session The session to respond on
+     * @param headers Headers to send, Transfer-Encoding is added
+     * @param producer Called for every element until it returns false
+     * @param keepAlive Leave the connection open for the next request
+     * @param completion Optionally receives the array when it's complete and
+     *                   not larger than captureLimit bytes
+     * @param captureLimit Largest array that's passed to the completion
+     */
+    static void send(const std::shared_ptr<restbed::Session>& session, std::multimap<std::string, std::string> headers, Producer producer, bool keepAlive, Completion completion = Completion(), size_t captureLimit = 0);
+
+private:
+    JsonArrayStream(Producer producer, bool keepAlive, Completion completion, size_t captureLimit);
+
+    /** Produces elements until the chunk is full or the array is complete,
+     * and writes them */
+    void writeChunk(const std::shared_ptr<restbed::Session>& session);
+
+    Producer producer;
+    bool keepAlive;
+    bool firstElement;
+    Completion completion;
+    size_t captureLimit;
+
+    // Copy of the array sent so far, while there's a completion to call
+    std::string captured;
+};
+
+}
+
+#endif // JSONARRAYSTREAM_H_INCLUDED
@@ -0,0 +1,204 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef KEYBUILDER_H_INCLUDED
+#define KEYBUILDER_H_INCLUDED
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include "leveldb/db.h"
+
+namespace VtcBlockIndexer {
+
+/**
+ * The KeyBuilder composes database keys and values in a buffer on the stack,
+ * writing zero padded numbers digit by digit instead of going through a
+ * stringstream. The output is byte for byte what streaming the same parts
+ * with setw(width) << setfill('0') produced: numbers are padded up to the
+ * width and never truncated. Keys that outgrow the buffer move to the heap.
+ */
+
+class KeyBuilder {
+public:
+    KeyBuilder() : length(0), spilled(false) {}
+
+    KeyBuilder& append(const char* text) {
+        return append(text, strlen(text));
+    }
+
+    KeyBuilder& append(const std::string& text) {
+        return append(text.data(), text.size());
+    }
+
+    KeyBuilder& append(const char* data, size_t size) {
+        if(!spilled && length + size > capacity) {
+            heap.assign(buffer, length);
+            spilled = true;
+        }
+        if(spilled) {
+            heap.append(data, size);
+        } else {
+            memcpy(buffer + length, data, size);
+        }
+        length += size;
+        return *this;
+    }
+
+    /** Appends a number in decimal, padded with zeros to at least Width digits */
+    template<unsigned Width>
+    KeyBuilder& appendNumber(uint64_t number) {
+        char digits[20];
+        unsigned count = 0;
+        do {
+            digits[sizeof(digits) - ++count] = '0' + (number % 10);
+            number /= 10;
+        } while(number > 0);
+        while(count < Width && count < sizeof(digits)) {
+            digits[sizeof(digits) - ++count] = '0';
+        }
+        return append(digits + sizeof(digits) - count, count);
+    }
+
+    /** Appends bytes as lowercase hex */
+    KeyBuilder& appendHex(const unsigned char* data, size_t size) {
+        static const char hexDigits[] = "0123456789abcdef";
+        char pair[2];
+        for(size_t i = 0; i < size; i++) {
+            pair[0] = hexDigits[data[i] >> 4];
+            pair[1] = hexDigits[data[i] & 0x0F];
+            append(pair, 2);
+        }
+        return *this;
+    }
+
+    const char* data() const {
+        return spilled ? heap.data() : buffer;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    /** Returns a slice pointing into the builder, valid while the builder lives */
+    leveldb::Slice slice() const {
+        return leveldb::Slice(data(), length);
+    }
+
+    std::string str() const {
+        return std::string(data(), length);
+    }
+
+private:
+    static const size_t capacity = 192;
+    char buffer[capacity];
+    size_t length;
+    bool spilled;
+    std::string heap;
+};
+
+/**
+ * Widths of the zero padded numbers in the database keys and values. These
+ * are part of the on-disk format.
+ */
+namespace KeyWidth {
+    const unsigned Height = 8;      // block heights in keys
+    const unsigned Index = 8;       // counters, output and transaction indexes
+    const unsigned FilePosition = 12;
+    const unsigned Value = 16;      // amounts in satoshis
+    const unsigned Timestamp = 12;  // block times in eSign/identity records
+    const unsigned EsignHeight = 12; // block heights in eSign/identity records
+}
+
+/**
+ * Builders for the keys in the index. Each returns the exact key the indexer
+ * writes, so the indexer, HTTP server and caches can't drift apart.
+ */
+namespace Keys {
+    /** block-<height> holds the hash of the block at that height */
+    inline KeyBuilder block(uint64_t height) {
+        return KeyBuilder().append("block-", 6).appendNumber<KeyWidth::Height>(height);
+    }
+
+    /** block-<field>-<height>, for filePosition, time, size, txcount and txs (the
+     * block's txids packed into 32 bytes each, in block order) */
+    inline KeyBuilder blockField(const char* field, uint64_t height) {
+        return KeyBuilder().append("block-", 6).append(field).append("-", 1).appendNumber<KeyWidth::Height>(height);
+    }
+
+    /** block-hash-<hash> holds the height of a block */
+    inline KeyBuilder blockHash(const std::string& blockHash) {
+        return KeyBuilder().append("block-hash-", 11).append(blockHash);
+    }
+
+    /** tx-<txid> holds where a transaction is: height, index in the block,
+     * position in the block file and the block file name */
+    inline KeyBuilder tx(const std::string& txid) {
+        return KeyBuilder().append("tx-", 3).append(txid);
+    }
+
+    /** <owner>-<type>-<n>: the n-th record of a kind for an address or block hash */
+    inline KeyBuilder counted(const std::string& owner, const char* type, uint64_t n) {
+        return KeyBuilder().append(owner).append("-", 1).append(type).append("-", 1).appendNumber<KeyWidth::Index>(n);
+    }
+
+    /** <prefix>-<n>: the n-th record under a counter prefix */
+    inline KeyBuilder counted(const std::string& prefix, uint64_t n) {
+        return KeyBuilder().append(prefix).append("-", 1).appendNumber<KeyWidth::Index>(n);
+    }
+
+    /** <address>-txo-<height>-<sequence> holds an output paid to the address
+     * (txid, vout, height, value). Ordered by height, so history since a
+     * block is a seek away.
+     */
+    inline KeyBuilder addressTxo(const std::string& address, uint64_t height, uint32_t sequence) {
+        return KeyBuilder().append(address).append("-txo-", 5).appendNumber<KeyWidth::Height>(height).append("-", 1).appendNumber<KeyWidth::Index>(sequence);
+    }
+
+    /** Start of the address TXOs at or after a height */
+    inline KeyBuilder addressTxoFrom(const std::string& address, uint64_t height) {
+        return KeyBuilder().append(address).append("-txo-", 5).appendNumber<KeyWidth::Height>(height).append("-", 1);
+    }
+
+    /** Length of the "-txo-<height>-<sequence>" part of an address TXO key */
+    const size_t addressTxoSuffixSize = 5 + KeyWidth::Height + 1 + KeyWidth::Index;
+
+    /** <address>-utxo-<txid><vout> holds the height and value of an unspent
+     * output paid to the address. Removed when the output is spent.
+     */
+    inline KeyBuilder addressUtxo(const std::string& address, const std::string& txid, uint32_t vout) {
+        return KeyBuilder().append(address).append("-utxo-", 6).append(txid).appendNumber<KeyWidth::Index>(vout);
+    }
+
+    /** txo-<txid>-<vout>-spent holds the block hash and txid that spent an output */
+    inline KeyBuilder txoSpent(const std::string& txid, uint32_t vout) {
+        return KeyBuilder().append("txo-", 4).append(txid).append("-", 1).appendNumber<KeyWidth::Index>(vout).append("-spent", 6);
+    }
+
+    /** <txid><vout> holds the value and address of an unspent output */
+    inline KeyBuilder utxo(const std::string& txid, uint32_t vout) {
+        return KeyBuilder().append(txid).appendNumber<KeyWidth::Index>(vout);
+    }
+}
+
+}
+
+#endif // KEYBUILDER_H_INCLUDED
@@ -36,27 +36,33 @@
 #include "httpserver.h"
 #include "mempoolmonitor.h"
 #include "blockfilewatcher.h"
+#include "blockindexer.h"
+#include "utxocache.h"
+#include "chainsnapshot.h"
+#include "changecounters.h"
+#include "blocksummaryfile.h"
 #include <thread>
 
 using namespace std;
 
 bool testnet = false;
 leveldb::DB *db;
-VtcBlockIndexer::HttpServer httpServer(nullptr,nullptr,"");
-VtcBlockIndexer::BlockFileWatcher blockFileWatcher("",nullptr, nullptr);
-VtcBlockIndexer::MempoolMonitor mempoolMonitor(nullptr);
+VtcBlockIndexer::UtxoCache *utxoCache;
+VtcBlockIndexer::ChainSnapshot *chainSnapshot;
+VtcBlockIndexer::ChangeCounters *changeCounters;
+VtcBlockIndexer::BlockSummaryFile *blockSummaries;
+VtcBlockIndexer::BlockFileWatcher *blockFileWatcher;
+VtcBlockIndexer::MempoolMonitor *mempoolMonitor;
 
 void runBlockfileWatcher(string blocksDir) {
     cout << "Starting blockfile watcher..." << endl;
-    blockFileWatcher = VtcBlockIndexer::BlockFileWatcher(blocksDir, db, &mempoolMonitor);
-    blockFileWatcher.startWatcher();
+    blockFileWatcher = new VtcBlockIndexer::BlockFileWatcher(blocksDir, db, mempoolMonitor, utxoCache, chainSnapshot, blockSummaries);
+    blockFileWatcher->startWatcher();
 }
 
 void runMempoolMonitor() {
     cout << "Starting mempool monitor..." << endl;
-    mempoolMonitor = VtcBlockIndexer::MempoolMonitor(db);
-    mempoolMonitor.testnet = testnet;
-    mempoolMonitor.startWatcher();
+    mempoolMonitor->startWatcher();
 }
 
 
@@ -80,6 +86,28 @@ int main(int argc, char* argv[]) {
     leveldb::Status status = leveldb::DB::Open(options, "/index", &db);
     assert(status.ok());
 
+    if(!VtcBlockIndexer::BlockIndexer::checkIndexVersion(db)) {
+        cerr << "The index in /index was built by an older version and can't be upgraded. Remove it and restart to reindex." << endl;
+        exit(1);
+    }
+
+    // Keep up to 500k recently created outputs in memory while indexing
+    utxoCache = new VtcBlockIndexer::UtxoCache(db, 500000);
+
+    // Tell the HTTP server which cached responses are outdated
+    changeCounters = new VtcBlockIndexer::ChangeCounters();
+
+    // The mempool monitor is shared by the indexer and the HTTP server, so
+    // it's created before any of the threads start
+    mempoolMonitor = new VtcBlockIndexer::MempoolMonitor(db, utxoCache, changeCounters);
+    mempoolMonitor->testnet = testnet;
+
+    // The HTTP server reads from the snapshot published by the indexer
+    chainSnapshot = new VtcBlockIndexer::ChainSnapshot(db, changeCounters, mempoolMonitor);
+
+    // Fixed-size record per block, written by the indexer and mapped by the HTTP server
+    blockSummaries = new VtcBlockIndexer::BlockSummaryFile("/index/blocksummary.dat");
+
     // Start blockfile watcher on separate thread
     std::thread watcherThread(runBlockfileWatcher, string(argv[1]));   
     
@@ -87,6 +115,6 @@ int main(int argc, char* argv[]) {
     std::thread mempoolThread(runMempoolMonitor);   
     
     // Start webserver on main thread.
-    httpServer = VtcBlockIndexer::HttpServer(db, &mempoolMonitor, string(argv[1]));
+    VtcBlockIndexer::HttpServer httpServer(db, mempoolMonitor, chainSnapshot, changeCounters, blockSummaries, string(argv[1]));
     httpServer.run(); 
 }
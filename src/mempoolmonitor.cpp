@@ -24,71 +24,137 @@
 #include <unordered_map>
 #include <chrono>
 #include <thread>
+#include <shared_mutex>
+#include <algorithm>
 #include <time.h>
 #include "byte_array_buffer.h"
+#include "keybuilder.h"
 using namespace std;
 
 // This map keeps the memorypool transactions deserialized in memory.
 
 
-VtcBlockIndexer::MempoolMonitor::MempoolMonitor(leveldb::DB* dbInstance) {
+VtcBlockIndexer::MempoolMonitor::MempoolMonitor(leveldb::DB* dbInstance, VtcBlockIndexer::UtxoCache* utxoCache, VtcBlockIndexer::ChangeCounters* changeCounters) {
     this->db = dbInstance;
+    this->utxoCache = utxoCache;
+    this->changeCounters = changeCounters;
     httpClient.reset(new jsonrpc::HttpClient("http://middleware:middleware@" + std::string(std::getenv("VERTCOIND_HOST")) + ":8332"));
     vertcoind.reset(new VertcoinClient(*httpClient));
     blockReader.reset(new VtcBlockIndexer::BlockReader(""));
     scriptSolver.reset(new VtcBlockIndexer::ScriptSolver());
-    mempoolEsignTransactions = {};
-    mempoolIdentityTransactions = {};
+    detectors = VtcBlockIndexer::TransactionDetector::createDetectors(utxoCache, this);
 }
 
 void VtcBlockIndexer::MempoolMonitor::startWatcher() {
     while(true) {
         scriptSolver->testnet = testnet;
-        
+        for(const unique_ptr<VtcBlockIndexer::TransactionDetector>& detector : detectors) {
+            detector->setTestnet(testnet);
+        }
+
         try {
             const Json::Value mempool = vertcoind->getrawmempool();
             for ( uint index = 0; index < mempool.size(); ++index )
             {
-                if(mempoolTransactions.find(mempool[index].asString()) == mempoolTransactions.end()) {
-                    const Json::Value rawTx = vertcoind->getrawtransaction(mempool[index].asString(), false);
-                    std::vector<unsigned char> rawTxBytes = VtcBlockIndexer::Utility::hexToBytes(rawTx.asString());
-
-                    byte_array_buffer streambuf(&rawTxBytes[0], rawTxBytes.size());
-                    std::istream stream(&streambuf);
-
-                    VtcBlockIndexer::Transaction tx = blockReader->readTransaction(stream);
-                    mempoolTransactions[mempool[index].asString()] = tx;
-
-                    Block virtualBlock;
-                    virtualBlock.transactions = {};
-                    virtualBlock.transactions.push_back(tx);
-                    virtualBlock.height = 0;
-                    virtualBlock.time = 0;
-                    vector<EsignatureTransaction> esignTxes = VtcBlockIndexer::Utility::parseEsignatureTransactions(virtualBlock, db, scriptSolver.get(), this );
-                    for(EsignatureTransaction estx : esignTxes) {
-                        cout << "Found mempool eSign transaction!" << endl;
-                        
-                        mempoolEsignTransactions.push_back(estx);
+                const string txid = mempool[index].asString();
+                {
+                    shared_lock<shared_timed_mutex> lock(mempoolMutex);
+                    if(mempoolTransactions.find(txid) != mempoolTransactions.end()) {
+                        continue;
                     }
+                }
 
-                    vector<IdentityTransaction> identityTxes = VtcBlockIndexer::Utility::parseIdentityTransactions(virtualBlock, db, scriptSolver.get(), this );
-                     for(IdentityTransaction idtx : identityTxes) {
-                        cout << "Found mempool identity transaction!" << endl;
-                        
-                        mempoolIdentityTransactions.push_back(idtx);
+                const Json::Value rawTx = vertcoind->getrawtransaction(txid, false);
+                std::vector<unsigned char> rawTxBytes = VtcBlockIndexer::Utility::hexToBytes(rawTx.asString());
+
+                byte_array_buffer streambuf(&rawTxBytes[0], rawTxBytes.size());
+                std::istream stream(&streambuf);
+
+                VtcBlockIndexer::Transaction tx = blockReader->readTransaction(stream);
+
+                // The detectors look up funding addresses through this class,
+                // so they run before the lock is taken
+                vector<pair<string, VtcBlockIndexer::DetectedTransaction>> matches;
+                for(const unique_ptr<VtcBlockIndexer::TransactionDetector>& detector : detectors) {
+                    VtcBlockIndexer::DetectedTransaction match;
+                    if(detector->detect(tx, match)) {
+                        cout << "Found mempool " << detector->name() << " transaction!" << endl;
+                        match.height = 0;
+                        match.time = 0;
+                        matches.push_back(make_pair(detector->name(), match));
                     }
-                  
-                    for(VtcBlockIndexer::TransactionOutput out : tx.outputs) {
-                        out.txHash = tx.txHash;
-                        vector<string> addresses = scriptSolver->getAddressesFromScript(out.script);
-                        for(string address : addresses) {
-                            if(addressMempoolTransactions.find(address) == addressMempoolTransactions.end())
-                            {
-                                addressMempoolTransactions[address] = {};
-                            }
-                            addressMempoolTransactions[address].push_back(out);
+                }
+
+                vector<vector<string>> outputAddresses;
+                outputAddresses.reserve(tx.outputs.size());
+                for(const VtcBlockIndexer::TransactionOutput& out : tx.outputs) {
+                    outputAddresses.push_back(scriptSolver->getAddressesFromScript(out.script));
+                }
+
+                // Addresses that receive or spend an output of the transaction
+                vector<string> changedAddresses;
+                for(const vector<string>& addresses : outputAddresses) {
+                    changedAddresses.insert(changedAddresses.end(), addresses.begin(), addresses.end());
+                }
+                for(const auto& match : matches) {
+                    changedAddresses.push_back(match.second.fromAddress);
+                    changedAddresses.push_back(match.second.toAddress);
+                }
+                vector<vector<unsigned char>> spentMempoolScripts;
+
+                unique_lock<shared_timed_mutex> lock(mempoolMutex);
+                for(auto& match : matches) {
+                    mempoolDetectedTransactions[match.first].push_back(match.second);
+                }
+
+                vector<string>& transactionAddresses = mempoolTransactionAddresses[txid];
+                for(size_t outIdx = 0; outIdx < tx.outputs.size(); outIdx++) {
+                    for(const string& address : outputAddresses.at(outIdx)) {
+                        vector<VtcBlockIndexer::TransactionOutput>& addressTxos = addressMempoolTransactions[address];
+                        addressTxos.push_back(tx.outputs.at(outIdx));
+                        addressTxos.back().txHash = tx.txHash;
+                        transactionAddresses.push_back(address);
+                    }
+                }
+
+                // Track the confirmed outputs this transaction spends, so they
+                // can be deducted from the confirmed balance of their address
+                for(const VtcBlockIndexer::TransactionInput& txi : tx.inputs) {
+                    if(!txi.coinbase) {
+                        mempoolOutpointSpends[VtcBlockIndexer::Keys::utxo(txi.txHash, txi.txoIndex).str()] = tx.txHash;
+                    }
+                    if(txi.coinbase) {
+                        continue;
+                    }
+                    auto parent = mempoolTransactions.find(txi.txHash);
+                    if(parent != mempoolTransactions.end()) {
+                        if(txi.txoIndex < parent->second.outputs.size()) {
+                            spentMempoolScripts.push_back(parent->second.outputs.at(txi.txoIndex).script);
                         }
+                        continue;
                     }
+                    VtcBlockIndexer::TransactionOutput spentOut;
+                    string address;
+                    if(utxoCache->get(txi.txHash, txi.txoIndex, address, spentOut.value)) {
+                        spentOut.txHash = txi.txHash;
+                        spentOut.index = txi.txoIndex;
+                        addressMempoolSpends[address].push_back(spentOut);
+                        transactionAddresses.push_back(address);
+                        changedAddresses.push_back(address);
+                    }
+                }
+
+                mempoolTransactions[txid] = std::move(tx);
+                lock.unlock();
+
+                // Readers read the counters before the mempool, so they're
+                // increased once the transaction is visible
+                for(const vector<unsigned char>& script : spentMempoolScripts) {
+                    vector<string> addresses = scriptSolver->getAddressesFromScript(script);
+                    changedAddresses.insert(changedAddresses.end(), addresses.begin(), addresses.end());
+                }
+                for(const string& address : changedAddresses) {
+                    changeCounters->addressChanged(address);
                 }
             }
         } catch(const jsonrpc::JsonRpcException& e) {
@@ -101,103 +167,131 @@ void VtcBlockIndexer::MempoolMonitor::startWatcher() {
 }
 
 string VtcBlockIndexer::MempoolMonitor::outpointSpend(string txid, uint32_t vout) {
-    for (auto kvp : mempoolTransactions) {
-        VtcBlockIndexer::Transaction tx = kvp.second;
-        for (VtcBlockIndexer::TransactionInput txi : tx.inputs) {
-            if(txi.txHash.compare(txid) == 0 && txi.txoIndex == vout) {
-                return tx.txHash;
-            }
-        }
+    shared_lock<shared_timed_mutex> lock(mempoolMutex);
+    auto it = mempoolOutpointSpends.find(VtcBlockIndexer::Keys::utxo(txid, vout).str());
+    if(it == mempoolOutpointSpends.end()) {
+        return "";
     }
-    return "";
+    return it->second;
 }
  
 vector<VtcBlockIndexer::TransactionOutput> VtcBlockIndexer::MempoolMonitor::getTxos(std::string address) {
-    if(addressMempoolTransactions.find(address) == addressMempoolTransactions.end())
+    shared_lock<shared_timed_mutex> lock(mempoolMutex);
+    auto it = addressMempoolTransactions.find(address);
+    if(it == addressMempoolTransactions.end())
     {
         return {};
     } 
-    return vector<VtcBlockIndexer::TransactionOutput>(addressMempoolTransactions[address]);
+    return it->second;
+}
+
+vector<VtcBlockIndexer::TransactionOutput> VtcBlockIndexer::MempoolMonitor::getSpentTxos(std::string address) {
+    shared_lock<shared_timed_mutex> lock(mempoolMutex);
+    auto it = addressMempoolSpends.find(address);
+    if(it == addressMempoolSpends.end())
+    {
+        return {};
+    } 
+    return it->second;
 }
 
 string VtcBlockIndexer::MempoolMonitor::getTxoAddress(string txid, uint32_t vout) {
-    for (auto kvp : mempoolTransactions) {
-        VtcBlockIndexer::Transaction tx = kvp.second;
-        for (VtcBlockIndexer::TransactionOutput txo : tx.outputs) {
-            if(tx.txHash.compare(txid) == 0 && txo.index == vout) {
-                vector<string> addresses = scriptSolver->getAddressesFromScript(txo.script);
-                if(addresses.size() > 0) return addresses.at(0);
-            }
+    vector<unsigned char> script;
+    {
+        shared_lock<shared_timed_mutex> lock(mempoolMutex);
+        auto it = mempoolTransactions.find(txid);
+        if(it == mempoolTransactions.end() || vout >= it->second.outputs.size()) {
+            return "";
         }
+        script = it->second.outputs.at(vout).script;
     }
+    vector<string> addresses = scriptSolver->getAddressesFromScript(script);
+    if(addresses.size() > 0) return addresses.at(0);
     return "";
 }
 
-vector<VtcBlockIndexer::EsignatureTransaction> VtcBlockIndexer::MempoolMonitor::getEsignTransactionsFrom(std::string address) {
-    vector<EsignatureTransaction> newVector = {};
-    for(EsignatureTransaction tx : mempoolEsignTransactions) {
-        if(tx.fromAddress.compare(address) == 0) { 
+vector<VtcBlockIndexer::DetectedTransaction> VtcBlockIndexer::MempoolMonitor::getDetectedTransactions(std::string type, std::string address, bool matchFrom) {
+    vector<DetectedTransaction> newVector = {};
+    shared_lock<shared_timed_mutex> lock(mempoolMutex);
+    auto it = mempoolDetectedTransactions.find(type);
+    if(it == mempoolDetectedTransactions.end()) {
+        return newVector;
+    }
+    for(const DetectedTransaction& tx : it->second) {
+        const string& txAddress = matchFrom ? tx.fromAddress : tx.toAddress;
+        if(txAddress.compare(address) == 0) {
             newVector.push_back(tx);
         }
     }
     return newVector;
 }
 
+vector<VtcBlockIndexer::EsignatureTransaction> VtcBlockIndexer::MempoolMonitor::getEsignTransactionsFrom(std::string address) {
+    return getDetectedTransactions("esign", address, true);
+}
+
 vector<VtcBlockIndexer::EsignatureTransaction> VtcBlockIndexer::MempoolMonitor::getEsignTransactionsTo(std::string address) {
-    vector<EsignatureTransaction> newVector = {};
-    for(EsignatureTransaction tx : mempoolEsignTransactions) {
-        if(tx.toAddress.compare(address) == 0) { 
-            newVector.push_back(tx);
-        }
-    }
-    return newVector; 
+    return getDetectedTransactions("esign", address, false);
 }
-    
+
 vector<VtcBlockIndexer::IdentityTransaction> VtcBlockIndexer::MempoolMonitor::getIdentityTransactions(std::string address) {
-    vector<IdentityTransaction> newVector = {};
-    for(IdentityTransaction tx : mempoolIdentityTransactions) {
-        if(tx.toAddress.compare(address) == 0) { 
-            newVector.push_back(tx);
-        }
-    }
-    return newVector; 
+    return getDetectedTransactions("ident", address, false);
 }
-    
 
 void VtcBlockIndexer::MempoolMonitor::transactionIndexed(std::string txid) {
-    if(mempoolTransactions.find(txid) != mempoolTransactions.end()) {
-        mempoolTransactions.erase(txid);
-
-        unordered_map<string, std::vector<VtcBlockIndexer::TransactionOutput>> changedMempoolAddressTxes;
-        for (auto kvp : addressMempoolTransactions) {
-
-            vector<VtcBlockIndexer::TransactionOutput> newVector = {};
-            bool itemsRemoved = false;
-            for (VtcBlockIndexer::TransactionOutput txo : kvp.second) {
-                if(txo.txHash.compare(txid) != 0) {
-                    newVector.push_back(txo);
-                } else {
-                    itemsRemoved = true;
-                }
-            }
+    unique_lock<shared_timed_mutex> lock(mempoolMutex);
+    auto txIt = mempoolTransactions.find(txid);
+    if(txIt != mempoolTransactions.end()) {
+        VtcBlockIndexer::Transaction tx = std::move(txIt->second);
+        mempoolTransactions.erase(txIt);
 
-            if(itemsRemoved) {
-                changedMempoolAddressTxes[kvp.first] = newVector;
+        for (const VtcBlockIndexer::TransactionInput& txi : tx.inputs) {
+            if(!txi.coinbase) {
+                mempoolOutpointSpends.erase(VtcBlockIndexer::Keys::utxo(txi.txHash, txi.txoIndex).str());
             }
         }
 
-        for (auto kvp : changedMempoolAddressTxes) {
-            addressMempoolTransactions[kvp.first] = kvp.second;
+        // Only the addresses the transaction added entries for are touched
+        auto addressesIt = mempoolTransactionAddresses.find(txid);
+        if(addressesIt != mempoolTransactionAddresses.end()) {
+            for(const string& address : addressesIt->second) {
+                auto spendsIt = addressMempoolSpends.find(address);
+                if(spendsIt != addressMempoolSpends.end()) {
+                    vector<VtcBlockIndexer::TransactionOutput>& txos = spendsIt->second;
+                    txos.erase(remove_if(txos.begin(), txos.end(), [&tx](const VtcBlockIndexer::TransactionOutput& txo) {
+                        for (const VtcBlockIndexer::TransactionInput& txi : tx.inputs) {
+                            if(txi.txHash.compare(txo.txHash) == 0 && txi.txoIndex == txo.index) {
+                                return true;
+                            }
+                        }
+                        return false;
+                    }), txos.end());
+                    if(txos.empty()) {
+                        addressMempoolSpends.erase(spendsIt);
+                    }
+                }
+
+                auto txosIt = addressMempoolTransactions.find(address);
+                if(txosIt != addressMempoolTransactions.end()) {
+                    vector<VtcBlockIndexer::TransactionOutput>& txos = txosIt->second;
+                    txos.erase(remove_if(txos.begin(), txos.end(), [&txid](const VtcBlockIndexer::TransactionOutput& txo) {
+                        return txo.txHash.compare(txid) == 0;
+                    }), txos.end());
+                    if(txos.empty()) {
+                        addressMempoolTransactions.erase(txosIt);
+                    }
+                }
+            }
+            mempoolTransactionAddresses.erase(addressesIt);
         }
     }
 
-    vector<EsignatureTransaction> newVector = {};
-    for(EsignatureTransaction tx : mempoolEsignTransactions) {
-        if(tx.txId.compare(txid) != 0) { 
-            newVector.push_back(tx);
-        }
+    for(auto& kvp : mempoolDetectedTransactions) {
+        vector<DetectedTransaction>& detected = kvp.second;
+        detected.erase(remove_if(detected.begin(), detected.end(), [&txid](const DetectedTransaction& tx) {
+            return tx.txId.compare(txid) == 0;
+        }), detected.end());
     }
-    mempoolEsignTransactions = newVector;
 }
 
 
@@ -23,9 +23,13 @@
 #include <memory>
 #include "blockreader.h"
 #include "scriptsolver.h"
+#include "utxocache.h"
+#include "transactiondetector.h"
+#include "changecounters.h"
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
 #include <unordered_map>
+#include <shared_mutex>
 #ifndef MEMPOOLMONITOR_H_INCLUDED
 #define MEMPOOLMONITOR_H_INCLUDED
 
@@ -41,7 +45,7 @@ class MempoolMonitor {
 public:
     /** Constructs a MempoolMonitor instance
      */
-    MempoolMonitor(leveldb::DB* dbInstance);
+    MempoolMonitor(leveldb::DB* dbInstance, VtcBlockIndexer::UtxoCache* utxoCache, VtcBlockIndexer::ChangeCounters* changeCounters);
 
     /** Starts watching the mempool for new transactions */
     void startWatcher();
@@ -55,6 +59,9 @@ public:
     /** Returns TXOs in the memorypool matching an address */
     std::vector<VtcBlockIndexer::TransactionOutput> getTxos(std::string address);
 
+    /** Returns confirmed TXOs of an address that are spent by transactions in the memorypool */
+    std::vector<VtcBlockIndexer::TransactionOutput> getSpentTxos(std::string address);
+
     string getTxoAddress(string txid, uint32_t vout);
 
     std::vector<VtcBlockIndexer::EsignatureTransaction> getEsignTransactionsFrom(std::string address);
@@ -64,12 +71,25 @@ public:
     bool testnet;
 private:
     leveldb::DB* db;
+    VtcBlockIndexer::UtxoCache* utxoCache;
+    VtcBlockIndexer::ChangeCounters* changeCounters;
     std::unique_ptr<VertcoinClient> vertcoind;
     std::unique_ptr<jsonrpc::HttpClient> httpClient;
-    std::vector <VtcBlockIndexer::EsignatureTransaction> mempoolEsignTransactions;
-    std::vector <VtcBlockIndexer::IdentityTransaction> mempoolIdentityTransactions;
+    std::vector<VtcBlockIndexer::DetectedTransaction> getDetectedTransactions(std::string type, std::string address, bool matchFrom);
+    // Guards the maps below. The mempool thread and the indexer write them,
+    // the HTTP workers read them.
+    std::shared_timed_mutex mempoolMutex;
+    std::vector<std::unique_ptr<VtcBlockIndexer::TransactionDetector>> detectors;
+    // Detected transactions in the memorypool, keyed by detector name
+    unordered_map<string, std::vector<VtcBlockIndexer::DetectedTransaction>> mempoolDetectedTransactions;
     unordered_map<string, VtcBlockIndexer::Transaction> mempoolTransactions;
     unordered_map<string, std::vector<VtcBlockIndexer::TransactionOutput>> addressMempoolTransactions;
+    unordered_map<string, std::vector<VtcBlockIndexer::TransactionOutput>> addressMempoolSpends;
+    // Addresses with entries in the two maps above per mempool txid, so they
+    // can be removed without a scan once the transaction is indexed
+    unordered_map<string, std::vector<string>> mempoolTransactionAddresses;
+    // Spending txid per outpoint (txid + vout) spent in the memorypool
+    unordered_map<string, string> mempoolOutpointSpends;
     std::unique_ptr<VtcBlockIndexer::BlockReader> blockReader;
     std::unique_ptr<VtcBlockIndexer::ScriptSolver> scriptSolver;
 }; 
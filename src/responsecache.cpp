@@ -0,0 +1,73 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "responsecache.h"
+
+using namespace std;
+
+VtcBlockIndexer::ResponseCache::ResponseCache(size_t maxBytes) {
+    this->maxBytes = maxBytes;
+    this->bytes = 0;
+}
+
+size_t VtcBlockIndexer::ResponseCache::maxResponseSize() const {
+    // Keep room for a reasonable number of responses
+    return this->maxBytes / 64;
+}
+
+bool VtcBlockIndexer::ResponseCache::get(const string& key, uint64_t version, Response& response) {
+    lock_guard<mutex> lock(this->cacheMutex);
+    auto it = this->index.find(key);
+    if(it == this->index.end()) {
+        return false;
+    }
+    if(it->second->version != version) {
+        erase(it->second);
+        return false;
+    }
+    this->entries.splice(this->entries.begin(), this->entries, it->second);
+    response = it->second->response;
+    return true;
+}
+
+void VtcBlockIndexer::ResponseCache::put(const string& key, uint64_t version, const Response& response) {
+    if(response.body.size() > maxResponseSize()) {
+        return;
+    }
+
+    lock_guard<mutex> lock(this->cacheMutex);
+    auto it = this->index.find(key);
+    if(it != this->index.end()) {
+        erase(it->second);
+    }
+
+    this->entries.push_front(Entry{key, version, response});
+    this->index[key] = this->entries.begin();
+    this->bytes += key.size() + response.body.size();
+
+    while(this->bytes > this->maxBytes) {
+        erase(prev(this->entries.end()));
+    }
+}
+
+void VtcBlockIndexer::ResponseCache::erase(list<Entry>::iterator entry) {
+    this->bytes -= entry->key.size() + entry->response.body.size();
+    this->index.erase(entry->key);
+    this->entries.erase(entry);
+}
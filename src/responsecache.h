@@ -0,0 +1,89 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef RESPONSECACHE_H_INCLUDED
+#define RESPONSECACHE_H_INCLUDED
+
+#include <string>
+#include <map>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+namespace VtcBlockIndexer {
+
+/**
+ * The ResponseCache class keeps recently sent HTTP responses in memory, so a
+ * response can be sent again without running its queries. Every response is
+ * stored with the version of the data it was built from (a ChangeCounters
+ * value) and is only returned while the version is still the same. The least
+ * recently used responses are dropped when the cache is full.
+ */
+
+class ResponseCache {
+public:
+    struct Response {
+        int status;
+        std::string body;
+        std::multimap<std::string, std::string> headers;
+    };
+
+    /** Constructs a ResponseCache instance
+     *
+     * @param maxBytes Total size of the response bodies to keep
+     */
+    ResponseCache(size_t maxBytes);
+
+    /** Returns true and fills in the response when there's one stored for
+     * the key that was built from this version. Outdated responses are
+     * dropped.
+     */
+    bool get(const std::string& key, uint64_t version, Response& response);
+
+    /** Stores a response, replacing the one stored for the key before */
+    void put(const std::string& key, uint64_t version, const Response& response);
+
+    /** Returns the size of the largest body worth storing */
+    size_t maxResponseSize() const;
+
+private:
+    struct Entry {
+        std::string key;
+        uint64_t version;
+        Response response;
+    };
+
+    /** Removes an entry, the mutex must be held */
+    void erase(std::list<Entry>::iterator entry);
+
+    std::mutex cacheMutex;
+
+    // Most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    size_t bytes;
+    size_t maxBytes;
+};
+
+}
+
+#endif // RESPONSECACHE_H_INCLUDED
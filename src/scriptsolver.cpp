@@ -28,11 +28,100 @@
 #include <iomanip>
 
 using namespace std;
+
+// Number of solved scripts kept in memory. Shared by the indexer, mempool monitor and HTTP server.
+VtcBlockIndexer::AddressCache sharedAddressCache(100000);
+
 VtcBlockIndexer::ScriptSolver::ScriptSolver() {
     this->testnet = false;
 }
 
-vector<string> VtcBlockIndexer::ScriptSolver::getAddressesFromScript(vector<unsigned char> script) {
+VtcBlockIndexer::AddressCache& VtcBlockIndexer::ScriptSolver::addressCache() {
+    return sharedAddressCache;
+}
+
+vector<string> VtcBlockIndexer::ScriptSolver::getAddressesFromScript(const vector<unsigned char>& script) {
+    vector<string> addresses;
+    if(sharedAddressCache.get(script, this->testnet, addresses)) {
+        return addresses;
+    }
+
+    addresses = solveScript(script);
+
+    // Only cache scripts that pay to an address. Data carriers are unique
+    // and would just push out useful entries.
+    if(!addresses.empty()) {
+        sharedAddressCache.put(script, this->testnet, addresses);
+    }
+    return addresses;
+}
+
+string VtcBlockIndexer::ScriptSolver::getScriptType(const vector<unsigned char>& script) {
+    size_t scriptSize = script.size();
+    if(25 == scriptSize && 0x76 == script[0] && 0xA9 == script[1] && 20 == script[2] && 0x88 == script[23] && 0xAC == script[24]) {
+        return "pubkeyhash";
+    }
+    if(23 == scriptSize && 0xA9 == script[0] && 20 == script[1] && 0x87 == script[22]) {
+        return "scripthash";
+    }
+    if((67 == scriptSize && 65 == script[0] && 0xAC == script[66]) || (35 == scriptSize && 33 == script[0] && 0xAC == script[34])) {
+        return "pubkey";
+    }
+    if(22 == scriptSize && 0x00 == script[0] && 0x14 == script[1]) {
+        return "witness_v0_keyhash";
+    }
+    if(34 == scriptSize && 0x00 == script[0] && 0x20 == script[1]) {
+        return "witness_v0_scripthash";
+    }
+    if(scriptSize > 0 && 0x6A == script[0]) {
+        return "nulldata";
+    }
+    if(getMultiSigRequired(script) > 0) {
+        return "multisig";
+    }
+    return "nonstandard";
+}
+
+int VtcBlockIndexer::ScriptSolver::getRequiredSignatures(const vector<unsigned char>& script) {
+    const string type = getScriptType(script);
+    if(type == "multisig") {
+        return getMultiSigRequired(script);
+    }
+    if(type == "nulldata" || type == "nonstandard") {
+        return 0;
+    }
+    return 1;
+}
+
+int VtcBlockIndexer::ScriptSolver::getMultiSigRequired(const vector<unsigned char>& script) {
+    size_t scriptSize = script.size();
+
+    // OP_m <pubkey>... OP_n OP_CHECKMULTISIG, with 1 <= m <= n <= 16
+    if(
+            scriptSize < 3                      ||
+            0x51 > script[0]                    ||  // OP_m
+            0x60 < script[0]                    ||
+            0x51 > script[scriptSize-2]         ||  // OP_n
+            0x60 < script[scriptSize-2]         ||
+            script[0] > script[scriptSize-2]    ||
+            0xAE != script[scriptSize-1]            // OP_CHECKMULTISIG
+    ) {
+        return 0;
+    }
+
+    size_t position = 1;
+    int keys = 0;
+    while(position < scriptSize - 2 && (33 == script[position] || 65 == script[position])) {
+        position += script[position] + 1;
+        keys++;
+    }
+    if(position != scriptSize - 2 || keys != script[scriptSize-2] - 0x50) {
+        return 0;
+    }
+    return script[0] - 0x50;
+}
+
+vector<string> VtcBlockIndexer::ScriptSolver::solveScript(const vector<unsigned char>& script) {
     vector<string> addresses;
     uint64_t scriptSize = script.size();
     bool parsed = false;
@@ -26,6 +26,7 @@
 #include <fstream>
 
 #include "blockchaintypes.h"
+#include "addresscache.h"
 
 namespace VtcBlockIndexer {
 
@@ -42,9 +43,32 @@ public:
 
     /** Read addresses from script
      */
-    vector<string> getAddressesFromScript(vector<unsigned char> scriptString);
+    vector<string> getAddressesFromScript(const vector<unsigned char>& scriptString);
+
+    /** Returns the type of an output script, named the way vertcoind names it
+     * in decoded transactions
+     */
+    static string getScriptType(const vector<unsigned char>& script);
+
+    /** Returns how many signatures it takes to spend an output script, 0 when
+     * it isn't a standard type that can be spent
+     */
+    static int getRequiredSignatures(const vector<unsigned char>& script);
+
+    /** Returns the cache of solved scripts shared by all ScriptSolver instances
+     */
+    static VtcBlockIndexer::AddressCache& addressCache();
 
     bool testnet;
+
+private:
+    /** Parses the script and encodes the addresses, bypassing the cache
+     */
+    vector<string> solveScript(const vector<unsigned char>& script);
+
+    /** Returns m of a bare m-of-n multisig script, 0 when it isn't one
+     */
+    static int getMultiSigRequired(const vector<unsigned char>& script);
 };
 
 }
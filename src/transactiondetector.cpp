@@ -0,0 +1,195 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "transactiondetector.h"
+#include "mempoolmonitor.h"
+#include "utility.h"
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+// Defaults for the detectors, used unless overridden from the environment
+const string defaultEsignServiceAddresses = "WxVSkmSUCUXFsnTRVdy5s2jtXXiwdjg75P";
+const string defaultIdentityMarker = "6a044944454e"; // OP_RETURN OP_PUSHDATA(4) 'IDEN'
+
+bool VtcBlockIndexer::ScriptPattern::matches(const vector<unsigned char>& script) const {
+    if(prefix ? script.size() < bytes.size() : script.size() != bytes.size()) {
+        return false;
+    }
+    return memcmp(script.data(), bytes.data(), bytes.size()) == 0;
+}
+
+VtcBlockIndexer::TransactionDetector::TransactionDetector(VtcBlockIndexer::UtxoCache* utxoCache, VtcBlockIndexer::MempoolMonitor* mempoolMonitor) {
+    this->utxoCache = utxoCache;
+    this->mempoolMonitor = mempoolMonitor;
+}
+
+void VtcBlockIndexer::TransactionDetector::setTestnet(bool testnet) {
+    this->scriptSolver.testnet = testnet;
+}
+
+int VtcBlockIndexer::TransactionDetector::network() {
+    return this->scriptSolver.testnet ? 1 : 0;
+}
+
+vector<unique_ptr<VtcBlockIndexer::TransactionDetector>> VtcBlockIndexer::TransactionDetector::createDetectors(VtcBlockIndexer::UtxoCache* utxoCache, VtcBlockIndexer::MempoolMonitor* mempoolMonitor) {
+    const char* serviceAddressesEnv = std::getenv("ESIGN_SERVICE_ADDRESSES");
+    vector<string> serviceAddresses;
+    stringstream addressList(serviceAddressesEnv != NULL ? serviceAddressesEnv : defaultEsignServiceAddresses);
+    string address;
+    while(getline(addressList, address, ',')) {
+        if(!address.empty()) {
+            serviceAddresses.push_back(address);
+        }
+    }
+
+    const char* identityMarkerEnv = std::getenv("IDENTITY_MARKER");
+    vector<unsigned char> identityMarker = VtcBlockIndexer::Utility::hexToBytes(identityMarkerEnv != NULL ? identityMarkerEnv : defaultIdentityMarker);
+
+    vector<unique_ptr<VtcBlockIndexer::TransactionDetector>> detectors;
+    detectors.push_back(unique_ptr<VtcBlockIndexer::TransactionDetector>(new VtcBlockIndexer::EsignatureDetector(utxoCache, mempoolMonitor, serviceAddresses)));
+    detectors.push_back(unique_ptr<VtcBlockIndexer::TransactionDetector>(new VtcBlockIndexer::IdentityDetector(utxoCache, mempoolMonitor, identityMarker)));
+    return detectors;
+}
+
+string VtcBlockIndexer::TransactionDetector::findFundingAddress(const VtcBlockIndexer::Transaction& tx) {
+    const VtcBlockIndexer::TransactionInput& input = tx.inputs.at(0);
+    string address = utxoCache->getAddress(input.txHash, input.txoIndex);
+    if(address.compare("") == 0) {
+        address = mempoolMonitor->getTxoAddress(input.txHash, input.txoIndex);
+    }
+    if(address.compare("") == 0) {
+        cout << "TXO not found in " << name() << " TX" << endl;
+    }
+    return address;
+}
+
+VtcBlockIndexer::EsignatureDetector::EsignatureDetector(VtcBlockIndexer::UtxoCache* utxoCache, VtcBlockIndexer::MempoolMonitor* mempoolMonitor, const vector<string>& serviceAddresses) : TransactionDetector(utxoCache, mempoolMonitor) {
+    // An address only exists on one network, so it only yields a pattern for that one
+    for(int testnet = 0; testnet < 2; testnet++) {
+        for(const string& address : serviceAddresses) {
+            vector<unsigned char> script = VtcBlockIndexer::Utility::addressToScript(address, testnet == 1);
+            if(!script.empty()) {
+                this->servicePatterns[testnet].push_back({script, false});
+            }
+        }
+    }
+    if(this->servicePatterns[0].empty() && this->servicePatterns[1].empty()) {
+        cerr << "No valid eSign service address configured" << endl;
+    }
+}
+
+string VtcBlockIndexer::EsignatureDetector::name() {
+    return "esign";
+}
+
+bool VtcBlockIndexer::EsignatureDetector::detect(const VtcBlockIndexer::Transaction& tx, VtcBlockIndexer::DetectedTransaction& match) {
+    if(tx.outputs.size() != 4 || tx.inputs.empty()) {
+        return false;
+    }
+    if(tx.outputs.at(1).value != 100 || tx.outputs.at(2).value != 0 || tx.outputs.at(2).script.empty() || tx.outputs.at(2).script.at(0) != 0x6A) {
+        return false;
+    }
+
+    bool toService = false;
+    for(const VtcBlockIndexer::ScriptPattern& pattern : servicePatterns[network()]) {
+        if(pattern.matches(tx.outputs.at(3).script)) {
+            toService = true;
+            break;
+        }
+    }
+    if(!toService) {
+        return false;
+    }
+
+    // This is a signature TX. Find out the "from" address.
+    string address = findFundingAddress(tx);
+    if(address.compare("") == 0) {
+        return false;
+    }
+
+    vector<string> docAddresses = scriptSolver.getAddressesFromScript(tx.outputs.at(1).script);
+    if(docAddresses.size() != 1) {
+        return false;
+    }
+
+    match.fromAddress = address;
+    match.toAddress = docAddresses.at(0);
+    match.script = tx.outputs.at(2).script;
+    match.txId = tx.txHash;
+    return true;
+}
+
+vector<pair<string, string>> VtcBlockIndexer::EsignatureDetector::indexEntries(const VtcBlockIndexer::DetectedTransaction& match) {
+    return {
+        make_pair("esign-out-" + match.fromAddress, match.toAddress),
+        make_pair("esign-in-" + match.toAddress, match.fromAddress)
+    };
+}
+
+VtcBlockIndexer::IdentityDetector::IdentityDetector(VtcBlockIndexer::UtxoCache* utxoCache, VtcBlockIndexer::MempoolMonitor* mempoolMonitor, const vector<unsigned char>& marker) : TransactionDetector(utxoCache, mempoolMonitor) {
+    this->markerPattern.bytes = marker;
+    this->markerPattern.prefix = true;
+}
+
+string VtcBlockIndexer::IdentityDetector::name() {
+    return "ident";
+}
+
+bool VtcBlockIndexer::IdentityDetector::detect(const VtcBlockIndexer::Transaction& tx, VtcBlockIndexer::DetectedTransaction& match) {
+    if(tx.outputs.size() != 4 || tx.inputs.empty()) {
+        return false;
+    }
+
+    const vector<unsigned char>& payload = tx.outputs.at(3).script;
+    if(tx.outputs.at(1).value != 100 ||
+        tx.outputs.at(2).value != 0 ||
+        !markerPattern.matches(tx.outputs.at(2).script) ||
+        tx.outputs.at(3).value != 0 ||
+        payload.empty() ||
+        payload.at(0) != 0x6A) {
+        return false;
+    }
+
+    // This is an identity TX. Find out the "from" address.
+    string address = findFundingAddress(tx);
+    if(address.compare("") == 0) {
+        return false;
+    }
+
+    vector<string> personAddress = scriptSolver.getAddressesFromScript(tx.outputs.at(1).script);
+    if(personAddress.size() != 1) {
+        return false;
+    }
+
+    match.fromAddress = address;
+    match.toAddress = personAddress.at(0);
+    match.script = payload;
+    match.txId = tx.txHash;
+    return true;
+}
+
+vector<pair<string, string>> VtcBlockIndexer::IdentityDetector::indexEntries(const VtcBlockIndexer::DetectedTransaction& match) {
+    return {
+        make_pair("ident-" + match.toAddress, match.fromAddress)
+    };
+}
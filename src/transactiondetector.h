@@ -0,0 +1,135 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TRANSACTIONDETECTOR_H_INCLUDED
+#define TRANSACTIONDETECTOR_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include "blockchaintypes.h"
+#include "scriptsolver.h"
+#include "utxocache.h"
+
+namespace VtcBlockIndexer {
+
+class MempoolMonitor;
+
+/**
+ * A ScriptPattern matches the raw bytes of an output script, either the
+ * whole script or only its start. It lets the detectors reject transactions
+ * with a fixed-size compare before solving any script or hitting the database.
+ */
+struct ScriptPattern {
+    std::vector<unsigned char> bytes;
+
+    // When true the script only has to start with the bytes
+    bool prefix;
+
+    bool matches(const std::vector<unsigned char>& script) const;
+};
+
+/**
+ * A TransactionDetector recognizes one type of special transaction (eSignature,
+ * identity). The indexer and the mempool monitor run every detector on each
+ * transaction they process, so adding a type means adding a detector.
+ */
+
+class TransactionDetector {
+public:
+    /** Constructs a TransactionDetector
+     *
+     * @param utxoCache Used to find the address that funded the transaction
+     * @param mempoolMonitor Used to find the funding address when it's unconfirmed
+     */
+    TransactionDetector(VtcBlockIndexer::UtxoCache* utxoCache, VtcBlockIndexer::MempoolMonitor* mempoolMonitor);
+    virtual ~TransactionDetector() {}
+
+    /** Name of the transaction type, used in logging and to keep mempool matches apart */
+    virtual std::string name() = 0;
+
+    /** Inspects the transaction. Returns true and fills in everything but height
+     * and time of the match when the transaction is of this type.
+     */
+    virtual bool detect(const VtcBlockIndexer::Transaction& tx, VtcBlockIndexer::DetectedTransaction& match) = 0;
+
+    /** Returns the index entries to write for a match, as pairs of key prefix and
+     * the counterpart address that is stored in the value.
+     */
+    virtual std::vector<std::pair<std::string, std::string>> indexEntries(const VtcBlockIndexer::DetectedTransaction& match) = 0;
+
+    /** Sets the network used to solve scripts */
+    void setTestnet(bool testnet);
+
+    /** Creates the detectors for all known transaction types. The eSign service
+     * addresses can be overridden with the comma separated ESIGN_SERVICE_ADDRESSES
+     * environment variable, the identity marker with IDENTITY_MARKER (hex).
+     */
+    static std::vector<std::unique_ptr<TransactionDetector>> createDetectors(VtcBlockIndexer::UtxoCache* utxoCache, VtcBlockIndexer::MempoolMonitor* mempoolMonitor);
+
+protected:
+    /** Returns the address owning the output spent by the first input, or an
+     * empty string when it can't be found */
+    std::string findFundingAddress(const VtcBlockIndexer::Transaction& tx);
+
+    /** Index into per network tables: 0 for mainnet, 1 for testnet */
+    int network();
+
+    VtcBlockIndexer::ScriptSolver scriptSolver;
+    VtcBlockIndexer::UtxoCache* utxoCache;
+    VtcBlockIndexer::MempoolMonitor* mempoolMonitor;
+};
+
+/**
+ * Detects eSignature transactions: a document output of 100 satoshi, a data
+ * carrier and an output to one of the eSign service addresses.
+ */
+class EsignatureDetector : public TransactionDetector {
+public:
+    EsignatureDetector(VtcBlockIndexer::UtxoCache* utxoCache, VtcBlockIndexer::MempoolMonitor* mempoolMonitor, const std::vector<std::string>& serviceAddresses);
+    std::string name();
+    bool detect(const VtcBlockIndexer::Transaction& tx, VtcBlockIndexer::DetectedTransaction& match);
+    std::vector<std::pair<std::string, std::string>> indexEntries(const VtcBlockIndexer::DetectedTransaction& match);
+
+private:
+    // Output scripts paying to the service addresses, per network
+    std::vector<VtcBlockIndexer::ScriptPattern> servicePatterns[2];
+};
+
+/**
+ * Detects identity transactions: an output of 100 satoshi to the person, an
+ * 'IDEN' data carrier and a second data carrier with the payload.
+ */
+class IdentityDetector : public TransactionDetector {
+public:
+    IdentityDetector(VtcBlockIndexer::UtxoCache* utxoCache, VtcBlockIndexer::MempoolMonitor* mempoolMonitor, const std::vector<unsigned char>& marker);
+    std::string name();
+    bool detect(const VtcBlockIndexer::Transaction& tx, VtcBlockIndexer::DetectedTransaction& match);
+    std::vector<std::pair<std::string, std::string>> indexEntries(const VtcBlockIndexer::DetectedTransaction& match);
+
+private:
+    VtcBlockIndexer::ScriptPattern markerPattern;
+};
+
+}
+
+#endif // TRANSACTIONDETECTOR_H_INCLUDED
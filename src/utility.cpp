@@ -25,10 +25,12 @@
 #include <memory>
 #include <iomanip>
 #include <vector>
+#include <algorithm>
 #include <secp256k1.h>
 #include "crypto/ripemd160.h"
 #include "crypto/base58.h"
 #include "crypto/bech32.h"
+#include "keybuilder.h"
 
 
 using namespace std;
@@ -62,6 +64,35 @@ namespace
         }
         return true;
     }
+
+    const string base58Alphabet = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+
+    // Decodes a base58 string to bytes. Returns an empty vector on invalid characters.
+    data decodeBase58(const string& in) {
+        data out;
+        size_t leadingZeros = 0;
+        while(leadingZeros < in.size() && in[leadingZeros] == '1') {
+            leadingZeros++;
+        }
+        for(size_t i = leadingZeros; i < in.size(); i++) {
+            size_t digit = base58Alphabet.find(in[i]);
+            if(digit == string::npos) {
+                return {};
+            }
+            int carry = (int)digit;
+            for(size_t j = out.size(); j-- > 0;) {
+                carry += 58 * out[j];
+                out[j] = carry & 0xFF;
+                carry >>= 8;
+            }
+            while(carry > 0) {
+                out.insert(out.begin(), carry & 0xFF);
+                carry >>= 8;
+            }
+        }
+        out.insert(out.begin(), leadingZeros, 0);
+        return out;
+    }
 }
 
 vector<unsigned char> VtcBlockIndexer::Utility::sha256(vector<unsigned char> input)
@@ -75,13 +106,16 @@ vector<unsigned char> VtcBlockIndexer::Utility::sha256(vector<unsigned char> inp
     return vector<unsigned char>(hash.get(), hash.get()+SHA256_DIGEST_LENGTH);
 }
 
-std::string VtcBlockIndexer::Utility::hashToHex(vector<unsigned char> hash) {
-    stringstream ss;
-    for(uint i = 0; i < hash.size(); i++)
+std::string VtcBlockIndexer::Utility::hashToHex(const vector<unsigned char>& hash) {
+    // Also used for whole raw transactions, so it avoids stringstream
+    static const char digits[] = "0123456789abcdef";
+    string hex(hash.size() * 2, '0');
+    for(size_t i = 0; i < hash.size(); i++)
     {
-        ss << hex << setw(2) << setfill('0') << (int)hash.at(i);
+        hex[2 * i] = digits[hash[i] >> 4];
+        hex[2 * i + 1] = digits[hash[i] & 0x0f];
     }
-    return ss.str();
+    return hex;
 }
 
 std::string VtcBlockIndexer::Utility::hashToReverseHex(vector<unsigned char> hash) {
@@ -158,6 +192,65 @@ vector<unsigned char> VtcBlockIndexer::Utility::hexToBytes(const std::string hex
     return bytes;
 }
 
+std::string VtcBlockIndexer::Utility::encodeAddressBalance(VtcBlockIndexer::AddressBalance balance) {
+    VtcBlockIndexer::KeyBuilder value;
+    value.appendNumber<VtcBlockIndexer::KeyWidth::Value>(balance.received)
+        .appendNumber<VtcBlockIndexer::KeyWidth::Value>(balance.spent)
+        .appendNumber<VtcBlockIndexer::KeyWidth::Index>(balance.txoCount)
+        .appendNumber<VtcBlockIndexer::KeyWidth::Index>(balance.unspentCount);
+    return value.str();
+}
+
+VtcBlockIndexer::AddressBalance VtcBlockIndexer::Utility::decodeAddressBalance(std::string value) {
+    VtcBlockIndexer::AddressBalance balance = {0, 0, 0, 0};
+    if(value.size() >= 48) {
+        balance.received = stoull(value.substr(0,16));
+        balance.spent = stoull(value.substr(16,16));
+        balance.txoCount = stoull(value.substr(32,8));
+        balance.unspentCount = stoull(value.substr(40,8));
+    }
+    return balance;
+}
+
+std::string VtcBlockIndexer::Utility::encodeTransactionLocation(const VtcBlockIndexer::TransactionLocation& location) {
+    VtcBlockIndexer::KeyBuilder value;
+    value.appendNumber<VtcBlockIndexer::KeyWidth::Height>(location.height)
+        .appendNumber<VtcBlockIndexer::KeyWidth::Index>(location.txIndex)
+        .appendNumber<VtcBlockIndexer::KeyWidth::FilePosition>(location.filePosition)
+        .append(location.fileName);
+    return value.str();
+}
+
+bool VtcBlockIndexer::Utility::decodeTransactionLocation(const std::string& value, VtcBlockIndexer::TransactionLocation& location) {
+    if(value.size() < 28) {
+        return false;
+    }
+    location.height = stoull(value.substr(0,8));
+    location.txIndex = stoull(value.substr(8,8));
+    location.filePosition = stoull(value.substr(16,12));
+    location.fileName = value.substr(28);
+    return true;
+}
+
+std::string VtcBlockIndexer::Utility::packTxids(const vector<VtcBlockIndexer::Transaction>& transactions) {
+    string packed;
+    packed.reserve(transactions.size() * 32);
+    for(const VtcBlockIndexer::Transaction& tx : transactions) {
+        vector<unsigned char> txid = hexToBytes(tx.txHash);
+        packed.append(txid.begin(), txid.end());
+    }
+    return packed;
+}
+
+vector<string> VtcBlockIndexer::Utility::unpackTxids(const std::string& packed) {
+    vector<string> txids;
+    txids.reserve(packed.size() / 32);
+    for(size_t i = 0; i + 32 <= packed.size(); i += 32) {
+        txids.push_back(hashToHex(vector<unsigned char>(packed.begin() + i, packed.begin() + i + 32)));
+    }
+    return txids;
+}
+
 vector<unsigned char> VtcBlockIndexer::Utility::ripeMD160(vector<unsigned char> in) {
     unsigned char hash[CRIPEMD160::OUTPUT_SIZE];
     CRIPEMD160().Write(in.data(), in.size()).Finalize(hash);
@@ -178,6 +271,45 @@ vector<unsigned char> VtcBlockIndexer::Utility::base58(vector<unsigned char> in)
     }
 }
 
+vector<unsigned char> VtcBlockIndexer::Utility::addressToScript(const std::string& address, bool testnet) {
+    // Segwit addresses
+    pair<string, vector<uint8_t>> bech = bech32::Decode(address);
+    if(!bech.first.empty()) {
+        vector<uint8_t> program;
+        if(bech.first != (testnet ? "tvtc" : "vtc") || bech.second.empty() || bech.second.at(0) != 0 ||
+            !convertbits<5, 8, false>(program, vector<uint8_t>(bech.second.begin() + 1, bech.second.end())) ||
+            (program.size() != 20 && program.size() != 32)) {
+            return {};
+        }
+        vector<unsigned char> script = { 0x00, (unsigned char)program.size() };
+        script.insert(script.end(), program.begin(), program.end());
+        return script;
+    }
+
+    // Base58 addresses: version byte, hash160 and a 4 byte checksum
+    vector<unsigned char> decoded = decodeBase58(address);
+    if(decoded.size() != 25) {
+        return {};
+    }
+    vector<unsigned char> checksum = sha256(sha256(vector<unsigned char>(decoded.begin(), decoded.begin() + 21)));
+    if(!equal(checksum.begin(), checksum.begin() + 4, decoded.begin() + 21)) {
+        return {};
+    }
+
+    vector<unsigned char> script;
+    if(decoded.at(0) == (testnet ? 0x4A : 0x47)) {
+        script = { 0x76, 0xA9, 20 };    // OP_DUP OP_HASH160 OP_PUSHDATA(20)
+        script.insert(script.end(), decoded.begin() + 1, decoded.begin() + 21);
+        script.push_back(0x88);         // OP_EQUALVERIFY
+        script.push_back(0xAC);         // OP_CHECKSIG
+    } else if(decoded.at(0) == (testnet ? 0xC4 : 0x05)) {
+        script = { 0xA9, 20 };          // OP_HASH160 OP_PUSHDATA(20)
+        script.insert(script.end(), decoded.begin() + 1, decoded.begin() + 21);
+        script.push_back(0x87);         // OP_EQUAL
+    }
+    return script;
+}
+
 vector<unsigned char> VtcBlockIndexer::Utility::bech32Address(vector<unsigned char> in, bool testnet) {
     vector<unsigned char> enc;
     enc.push_back(0); // witness version
@@ -189,93 +321,3 @@ vector<unsigned char> VtcBlockIndexer::Utility::bech32Address(vector<unsigned ch
         return {};
     }
 }
-
-vector<VtcBlockIndexer::EsignatureTransaction> VtcBlockIndexer::Utility::parseEsignatureTransactions(VtcBlockIndexer::Block block,leveldb::DB* db, VtcBlockIndexer::ScriptSolver* scriptSolver, VtcBlockIndexer::MempoolMonitor* mempoolMonitor) {
-
-    vector<VtcBlockIndexer::EsignatureTransaction> returnValue = {};
-    for(VtcBlockIndexer::Transaction tx : block.transactions) {
-        if(tx.outputs.size() == 4) {
-            if(tx.outputs.at(1).value == 100 && tx.outputs.at(2).value == 0 && tx.outputs.at(2).script.at(0) == 0x6A) {
-                vector<string> addresses = scriptSolver->getAddressesFromScript(tx.outputs.at(3).script);
-                if(addresses.size() == 1 && addresses.at(0).compare("WxVSkmSUCUXFsnTRVdy5s2jtXXiwdjg75P") == 0) {
-                    // This is a signature TX. Find out the "from" address.
-                    stringstream txoAddrKey;
-                    txoAddrKey << tx.inputs.at(0).txHash << setw(8) << setfill('0') << tx.inputs.at(0).txoIndex;
-                    string address;
-                    leveldb::Status s = db->Get(leveldb::ReadOptions(), txoAddrKey.str(), &address);
-                    bool ok = s.ok();
-                    if(!ok) {
-                        address = mempoolMonitor->getTxoAddress(tx.inputs.at(0).txHash,  tx.inputs.at(0).txoIndex);
-                        if(address.compare("") != 0) {
-                            ok = true;
-                        }
-                    }
-                    if(ok) {
-                        vector<string> docAddresses = scriptSolver->getAddressesFromScript(tx.outputs.at(1).script);
-                        if(docAddresses.size() == 1) {
-                            EsignatureTransaction trans;
-                            trans.fromAddress = address;
-                            trans.toAddress = docAddresses.at(0);
-                            trans.script = tx.outputs.at(2).script;
-                            trans.txId = tx.txHash;
-                            trans.time = block.time;
-                            trans.height = block.height;
-                            returnValue.push_back(trans);
-                        }
-                    } else {
-                        cout << "TXO not found in esignature TX" << endl;
-                    }
-                }
-            }
-        }
-    }
-    return returnValue;
-}
-
-
-vector<VtcBlockIndexer::IdentityTransaction> VtcBlockIndexer::Utility::parseIdentityTransactions(VtcBlockIndexer::Block block,leveldb::DB* db, VtcBlockIndexer::ScriptSolver* scriptSolver, VtcBlockIndexer::MempoolMonitor* mempoolMonitor) {
-    vector<VtcBlockIndexer::IdentityTransaction> returnValue = {};
-    for(VtcBlockIndexer::Transaction tx : block.transactions) {
-        if(tx.outputs.size() == 4) {
-            if(tx.outputs.at(1).value == 100 && 
-            tx.outputs.at(2).value == 0 && 
-            tx.outputs.at(2).script.at(0) == 0x6A && 
-            tx.outputs.at(2).script.at(1) == 0x04 && 
-            tx.outputs.at(2).script.at(2) == 0x49 && 
-            tx.outputs.at(2).script.at(3) == 0x44 && 
-            tx.outputs.at(2).script.at(4) == 0x45 && 
-            tx.outputs.at(2).script.at(5) == 0x4e && 
-            tx.outputs.at(3).value == 0 && 
-            tx.outputs.at(3).script.at(0) == 0x6A) {
-                // This is an identity TX. Find out the "from" address.
-                stringstream txoAddrKey;
-                txoAddrKey << tx.inputs.at(0).txHash << setw(8) << setfill('0') << tx.inputs.at(0).txoIndex;
-                string address;
-                leveldb::Status s = db->Get(leveldb::ReadOptions(), txoAddrKey.str(), &address);
-                bool ok = s.ok();
-                if(!ok) {
-                    address = mempoolMonitor->getTxoAddress(tx.inputs.at(0).txHash,  tx.inputs.at(0).txoIndex);
-                    if(address.compare("") != 0) {
-                        ok = true;
-                    }
-                }
-                if(ok) {
-                    vector<string> personAddress = scriptSolver->getAddressesFromScript(tx.outputs.at(1).script);
-                    if(personAddress.size() == 1) {
-                        IdentityTransaction trans;
-                        trans.fromAddress = address;
-                        trans.toAddress = personAddress.at(0);
-                        trans.script = tx.outputs.at(3).script;
-                        trans.txId = tx.txHash;
-                        trans.time = block.time;
-                        trans.height = block.height;
-                        returnValue.push_back(trans);
-                    }
-                } else {
-                    cout << "TXO not found in esignature TX" << endl;
-                }
-            }
-        }
-    }
-    return returnValue;
-}
\ No newline at end of file
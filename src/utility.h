@@ -21,10 +21,6 @@
 #include <vector>
 #include <string>
 #include "blockchaintypes.h"
-#include "leveldb/db.h"
-#include "leveldb/write_batch.h"
-#include "scriptsolver.h"
-#include "mempoolmonitor.h"
 namespace VtcBlockIndexer {
     
     /**
@@ -38,7 +34,7 @@ namespace VtcBlockIndexer {
              * @param input the value to hash
              */
             static std::vector<unsigned char> sha256(std::vector<unsigned char> input);
-            static std::string hashToHex(std::vector<unsigned char> hash);
+            static std::string hashToHex(const std::vector<unsigned char>& hash);
             static std::string hashToReverseHex(std::vector<unsigned char> hash);
             static std::vector<unsigned char> decompressPubKey(std::vector<unsigned char> compressedKey);
             static std::vector<unsigned char> publicKeyToAddress(std::vector<unsigned char> publicKey, bool testnet);
@@ -48,8 +44,23 @@ namespace VtcBlockIndexer {
             static std::vector<unsigned char> ripeMD160ToP2SHAddress(std::vector<unsigned char> ripeMD, bool testnet);
             static std::vector<unsigned char> bech32Address(std::vector<unsigned char> in, bool testnet);
             static std::vector<unsigned char> hexToBytes(std::string hex);
-            static std::vector<VtcBlockIndexer::EsignatureTransaction> parseEsignatureTransactions(VtcBlockIndexer::Block block,leveldb::DB* db, VtcBlockIndexer::ScriptSolver* scriptSolver, VtcBlockIndexer::MempoolMonitor* mempoolMonitor);
-            static std::vector<VtcBlockIndexer::IdentityTransaction> parseIdentityTransactions(VtcBlockIndexer::Block block,leveldb::DB* db, VtcBlockIndexer::ScriptSolver* scriptSolver, VtcBlockIndexer::MempoolMonitor* mempoolMonitor);
+
+            /** Returns the output script that pays to an address, or an empty
+             * vector if the address is invalid or belongs to the other network
+             */
+            static std::vector<unsigned char> addressToScript(const std::string& address, bool testnet);
+            static std::string encodeAddressBalance(VtcBlockIndexer::AddressBalance balance);
+            static VtcBlockIndexer::AddressBalance decodeAddressBalance(std::string value);
+            static std::string encodeTransactionLocation(const VtcBlockIndexer::TransactionLocation& location);
+
+            /** Decodes a tx-<txid> record, returns false if the value is malformed */
+            static bool decodeTransactionLocation(const std::string& value, VtcBlockIndexer::TransactionLocation& location);
+
+            /** Packs the txids of a block's transactions, in block order, into
+             * 32 raw bytes per transaction
+             */
+            static std::string packTxids(const std::vector<VtcBlockIndexer::Transaction>& transactions);
+            static std::vector<std::string> unpackTxids(const std::string& packed);
             ~Utility();
             
         private:
@@ -0,0 +1,182 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "utxocache.h"
+#include "keybuilder.h"
+#include <iostream>
+
+using namespace std;
+
+// Flush pending outputs at least this often, so a crash does not lose hours of work
+const double maxSecondsBetweenFlushes = 300;
+
+VtcBlockIndexer::UtxoCache::UtxoCache(leveldb::DB* dbInstance, size_t maxEntries) {
+    this->db = dbInstance;
+    this->maxEntries = maxEntries;
+    time(&this->lastFlush);
+}
+
+string VtcBlockIndexer::UtxoCache::makeKey(const string& txid, uint32_t vout) {
+    return VtcBlockIndexer::Keys::utxo(txid, vout).str();
+}
+
+string VtcBlockIndexer::UtxoCache::makeValue(const Entry& entry) {
+    return VtcBlockIndexer::KeyBuilder().appendNumber<VtcBlockIndexer::KeyWidth::Value>(entry.value).append(entry.address).str();
+}
+
+void VtcBlockIndexer::UtxoCache::add(const string& txid, uint32_t vout, const string& address, uint64_t value) {
+    string key = makeKey(txid, vout);
+    lock_guard<mutex> lock(this->entriesMutex);
+    saveUndo(key);
+    Entry& entry = this->entries[key];
+    entry.address = address;
+    entry.value = value;
+    entry.dirty = true;
+}
+
+void VtcBlockIndexer::UtxoCache::remove(const string& txid, uint32_t vout, leveldb::WriteBatch& batch) {
+    string key = makeKey(txid, vout);
+    lock_guard<mutex> lock(this->entriesMutex);
+    saveUndo(key);
+    this->entries.erase(key);
+    batch.Delete(key);
+}
+
+void VtcBlockIndexer::UtxoCache::spend(const string& txid, uint32_t vout) {
+    string key = makeKey(txid, vout);
+    lock_guard<mutex> lock(this->entriesMutex);
+    saveUndo(key);
+    this->entries.erase(key);
+}
+
+void VtcBlockIndexer::UtxoCache::saveUndo(const string& key) {
+    Undo undo;
+    undo.key = key;
+    auto it = this->entries.find(key);
+    undo.existed = (it != this->entries.end());
+    if(undo.existed) {
+        undo.entry = it->second;
+    }
+    this->undoLog.push_back(std::move(undo));
+}
+
+string VtcBlockIndexer::UtxoCache::getAddress(const string& txid, uint32_t vout) {
+    string address;
+    uint64_t value;
+    if(!get(txid, vout, address, value)) {
+        return "";
+    }
+    return address;
+}
+
+bool VtcBlockIndexer::UtxoCache::get(const string& txid, uint32_t vout, string& address, uint64_t& value) {
+    string key = makeKey(txid, vout);
+    {
+        lock_guard<mutex> lock(this->entriesMutex);
+        auto it = this->entries.find(key);
+        if(it != this->entries.end()) {
+            address = it->second.address;
+            value = it->second.value;
+            return true;
+        }
+    }
+
+    string txoAddrValue;
+    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), key, &txoAddrValue);
+    if(!s.ok() || txoAddrValue.size() <= 16) {
+        return false;
+    }
+    value = stoull(txoAddrValue.substr(0,16));
+    address = txoAddrValue.substr(16);
+    return true;
+}
+
+bool VtcBlockIndexer::UtxoCache::needsFlush() {
+    lock_guard<mutex> lock(this->entriesMutex);
+    return this->entries.size() > this->maxEntries || difftime(time(NULL), this->lastFlush) >= maxSecondsBetweenFlushes;
+}
+
+void VtcBlockIndexer::UtxoCache::flush(leveldb::WriteBatch& batch) {
+    lock_guard<mutex> lock(this->entriesMutex);
+    for(auto& kvp : this->entries) {
+        if(kvp.second.dirty) {
+            batch.Put(kvp.first, makeValue(kvp.second));
+            this->flushedKeys.push_back(kvp.first);
+        }
+    }
+    time(&this->lastFlush);
+}
+
+void VtcBlockIndexer::UtxoCache::commit() {
+    lock_guard<mutex> lock(this->entriesMutex);
+    for(const string& key : this->flushedKeys) {
+        auto it = this->entries.find(key);
+        if(it != this->entries.end()) {
+            it->second.dirty = false;
+        }
+    }
+    this->flushedKeys.clear();
+    this->undoLog.clear();
+
+    if(this->entries.size() <= this->maxEntries) {
+        return;
+    }
+
+    // Written entries are read back from the database when they're needed
+    for(auto it = this->entries.begin(); it != this->entries.end();) {
+        if(it->second.dirty) {
+            ++it;
+        } else {
+            it = this->entries.erase(it);
+        }
+    }
+}
+
+void VtcBlockIndexer::UtxoCache::rollback() {
+    lock_guard<mutex> lock(this->entriesMutex);
+
+    // The flushed entries are still dirty and go into the next flush
+    this->flushedKeys.clear();
+    for(auto it = this->undoLog.rbegin(); it != this->undoLog.rend(); ++it) {
+        if(it->existed) {
+            this->entries[it->key] = it->entry;
+        } else {
+            this->entries.erase(it->key);
+        }
+    }
+    this->undoLog.clear();
+}
+
+bool VtcBlockIndexer::UtxoCache::flush() {
+    leveldb::WriteBatch batch;
+    flush(batch);
+    leveldb::Status s = this->db->Write(leveldb::WriteOptions(), &batch);
+    if(!s.ok()) {
+        cerr << "Failed to flush UTXO cache: " << s.ToString() << endl;
+        rollback();
+        return false;
+    }
+    commit();
+    return true;
+}
+
+size_t VtcBlockIndexer::UtxoCache::size() {
+    lock_guard<mutex> lock(this->entriesMutex);
+    return this->entries.size();
+}
@@ -0,0 +1,139 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef UTXOCACHE_H_INCLUDED
+#define UTXOCACHE_H_INCLUDED
+
+#include <string>
+#include <mutex>
+#include <ctime>
+#include <unordered_map>
+#include <vector>
+#include "leveldb/db.h"
+#include "leveldb/write_batch.h"
+
+namespace VtcBlockIndexer {
+
+/**
+ * The UtxoCache class keeps the outputs created by recently indexed blocks in
+ * memory, together with the address they pay to and their value. The
+ * txid+vout -> value+address records are only written to the database when
+ * the cache is flushed, so outputs that are created and spent between two
+ * flushes never hit the disk.
+ * Lookups for the address of an outpoint are served from memory and fall
+ * back to the database.
+ * Changes apply right away, so the rest of a block sees them, and are undone
+ * with rollback when the block's batch fails to write.
+ */
+
+class UtxoCache {
+public:
+    /** Constructs a UtxoCache instance
+     *
+     * @param dbInstance The database the outputs are flushed to
+     * @param maxEntries Number of outputs to keep before a flush is due
+     */
+    UtxoCache(leveldb::DB* dbInstance, size_t maxEntries);
+
+    /** Adds an output created by a block that is being indexed */
+    void add(const std::string& txid, uint32_t vout, const std::string& address, uint64_t value);
+
+    /** Removes an output whose block is being disconnected, including the
+     * record in the database */
+    void remove(const std::string& txid, uint32_t vout, leveldb::WriteBatch& batch);
+
+    /** Marks an output as spent. Outputs that were not flushed yet are
+     * dropped without ever being written once the spend is committed. */
+    void spend(const std::string& txid, uint32_t vout);
+
+    /** Returns the address an outpoint pays to, or an empty string when the
+     * outpoint is unknown */
+    std::string getAddress(const std::string& txid, uint32_t vout);
+
+    /** Looks up the address and value of an outpoint. Returns false when
+     * the outpoint is unknown */
+    bool get(const std::string& txid, uint32_t vout, std::string& address, uint64_t& value);
+
+    /** Returns true when the cache outgrew its size or was not flushed for
+     * a while */
+    bool needsFlush();
+
+    /** Adds the pending outputs to the passed batch. They are only
+     * considered written once the batch is committed. */
+    void flush(leveldb::WriteBatch& batch);
+
+    /** Call once the batch holding the changes since the last commit was
+     * written. Marks the flushed outputs as written and drops written
+     * entries from memory if the cache is too big. */
+    void commit();
+
+    /** Call when the batch holding the changes since the last commit failed
+     * to write. Undoes the adds, spends and removes since the last commit
+     * and keeps the flushed outputs pending. */
+    void rollback();
+
+    /** Writes the pending outputs to the database */
+    bool flush();
+
+    /** Number of outputs kept in memory */
+    size_t size();
+
+private:
+    struct Entry {
+        std::string address;
+
+        // Value of the output in satoshis
+        uint64_t value;
+
+        // True when the entry has not been written to the database yet
+        bool dirty;
+    };
+
+    // The state of an entry before it was changed, to undo the change
+    struct Undo {
+        std::string key;
+        bool existed;
+        Entry entry;
+    };
+
+    static std::string makeKey(const std::string& txid, uint32_t vout);
+    static std::string makeValue(const Entry& entry);
+
+    /** Records the current state of an entry before it's changed. Must be
+     * called with entriesMutex held. */
+    void saveUndo(const std::string& key);
+
+    leveldb::DB* db;
+    std::mutex entriesMutex;
+    std::unordered_map<std::string, Entry> entries;
+
+    // Changes since the last commit, oldest first
+    std::vector<Undo> undoLog;
+
+    // Outputs added to a batch that wasn't committed yet
+    std::vector<std::string> flushedKeys;
+    size_t maxEntries;
+    time_t lastFlush;
+};
+
+}
+
+#endif // UTXOCACHE_H_INCLUDED
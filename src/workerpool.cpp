@@ -0,0 +1,107 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "workerpool.h"
+#include <algorithm>
+
+using namespace std;
+
+VtcBlockIndexer::WorkerPool::WorkerPool(unsigned int threads) {
+    this->stopping = false;
+    if(threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if(threads == 0) {
+        threads = 1;
+    }
+    for(unsigned int i = 0; i < threads; i++) {
+        this->threads.push_back(std::thread(&VtcBlockIndexer::WorkerPool::workerLoop, this));
+    }
+}
+
+VtcBlockIndexer::WorkerPool::~WorkerPool() {
+    {
+        unique_lock<mutex> lock(this->tasksMutex);
+        this->stopping = true;
+    }
+    this->tasksAvailable.notify_all();
+    for(std::thread& thread : this->threads) {
+        thread.join();
+    }
+}
+
+unsigned int VtcBlockIndexer::WorkerPool::size() {
+    return this->threads.size();
+}
+
+void VtcBlockIndexer::WorkerPool::workerLoop() {
+    while(true) {
+        function<void()> task;
+        {
+            unique_lock<mutex> lock(this->tasksMutex);
+            this->tasksAvailable.wait(lock, [this] { return this->stopping || !this->tasks.empty(); });
+            if(this->tasks.empty()) {
+                return;
+            }
+            task = std::move(this->tasks.front());
+            this->tasks.pop();
+        }
+        task();
+    }
+}
+
+void VtcBlockIndexer::WorkerPool::parallelFor(size_t count, size_t minSliceSize, function<void(size_t, size_t)> work) {
+    if(minSliceSize == 0) {
+        minSliceSize = 1;
+    }
+
+    size_t slices = min((size_t)this->threads.size(), count / minSliceSize);
+    if(slices <= 1) {
+        // Not worth the hand-off, process on the calling thread
+        if(count > 0) {
+            work(0, count);
+        }
+        return;
+    }
+
+    size_t sliceSize = (count + slices - 1) / slices;
+    slices = (count + sliceSize - 1) / sliceSize;
+
+    mutex doneMutex;
+    condition_variable doneCondition;
+    size_t pending = slices;
+
+    {
+        unique_lock<mutex> lock(this->tasksMutex);
+        for(size_t begin = 0; begin < count; begin += sliceSize) {
+            size_t end = min(count, begin + sliceSize);
+            this->tasks.push([&work, &doneMutex, &doneCondition, &pending, begin, end] {
+                work(begin, end);
+                unique_lock<mutex> doneLock(doneMutex);
+                if(--pending == 0) {
+                    doneCondition.notify_one();
+                }
+            });
+        }
+    }
+    this->tasksAvailable.notify_all();
+
+    unique_lock<mutex> doneLock(doneMutex);
+    doneCondition.wait(doneLock, [&pending] { return pending == 0; });
+}
@@ -0,0 +1,77 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WORKERPOOL_H_INCLUDED
+#define WORKERPOOL_H_INCLUDED
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace VtcBlockIndexer {
+
+/**
+ * The WorkerPool class keeps a fixed set of threads alive and hands them
+ * slices of CPU bound work, so callers don't pay for thread creation on
+ * every block.
+ */
+
+class WorkerPool {
+public:
+    /** Constructs a WorkerPool instance
+     *
+     * @param threads Number of worker threads. Zero uses one per hardware thread.
+     */
+    WorkerPool(unsigned int threads = 0);
+    ~WorkerPool();
+
+    /** Splits the range [0, count) into slices and calls work(begin, end) for
+     * each slice on the workers. Blocks until every slice is done. Small ranges
+     * are executed on the calling thread.
+     *
+     * @param count Number of items to process
+     * @param minSliceSize Minimum number of items worth handing to a worker
+     * @param work Function processing the items from begin up to (excluding) end
+     */
+    void parallelFor(size_t count, size_t minSliceSize, std::function<void(size_t, size_t)> work);
+
+    /** Returns the number of worker threads */
+    unsigned int size();
+
+private:
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    void workerLoop();
+
+    std::vector<std::thread> threads;
+    std::queue<std::function<void()>> tasks;
+    std::mutex tasksMutex;
+    std::condition_variable tasksAvailable;
+    bool stopping;
+};
+
+}
+
+#endif // WORKERPOOL_H_INCLUDED
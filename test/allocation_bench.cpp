@@ -0,0 +1,158 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "blockreader.h"
+#include "scriptsolver.h"
+#include "allocationcounter.h"
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+using namespace std;
+
+// Shape of the block file the benchmark reads
+const int blockCount = 10;
+const int transactionsPerBlock = 1000;
+const int inputsPerTransaction = 2;
+const int outputsPerTransaction = 2;
+
+void writeInt(ofstream& file, uint64_t value, size_t size) {
+    for(size_t i = 0; i < size; i++) {
+        file.put((char)((value >> (8 * i)) & 0xff));
+    }
+}
+
+// Writes 32 bytes that differ for every seed
+void writeHash(ofstream& file, uint64_t seed) {
+    for(int i = 0; i < 4; i++) {
+        writeInt(file, seed * 2654435761u + i, 8);
+    }
+}
+
+// Writes a P2PKH output script paying to a key hash derived from the seed
+void writeOutputScript(ofstream& file, uint64_t seed) {
+    file.put(25);
+    file.put((char)0x76);
+    file.put((char)0xa9);
+    file.put(20);
+    writeInt(file, seed, 8);
+    writeInt(file, seed * 31, 8);
+    writeInt(file, seed * 17, 4);
+    file.put((char)0x88);
+    file.put((char)0xac);
+}
+
+// Writes a block file of blockCount blocks, each preceded by the network
+// magic and the block size like vertcoind writes them. Returns the
+// positions of the block headers.
+vector<uint64_t> writeBlockFile(const string& path) {
+    vector<uint64_t> positions;
+    ofstream file(path, ios_base::out | ios_base::binary);
+    uint64_t seed = 1;
+    for(int block = 0; block < blockCount; block++) {
+        writeInt(file, 0xdab5bffa, 4);
+        uint64_t sizePosition = file.tellp();
+        writeInt(file, 0, 4);
+        positions.push_back(file.tellp());
+
+        writeInt(file, 1, 4);
+        writeHash(file, seed++);
+        writeHash(file, seed++);
+        writeInt(file, 1500000000 + block, 4);
+        writeInt(file, 0x1b00ffff, 4);
+        writeInt(file, block, 4);
+
+        file.put((char)0xfd);
+        writeInt(file, transactionsPerBlock, 2);
+        for(int tx = 0; tx < transactionsPerBlock; tx++) {
+            writeInt(file, 1, 4);
+            file.put(inputsPerTransaction);
+            for(int input = 0; input < inputsPerTransaction; input++) {
+                writeHash(file, seed++);
+                writeInt(file, input, 4);
+                file.put(107);
+                for(int i = 0; i < 107; i++) {
+                    file.put((char)(seed + i));
+                }
+                writeInt(file, 0xffffffff, 4);
+            }
+            file.put(outputsPerTransaction);
+            for(int output = 0; output < outputsPerTransaction; output++) {
+                writeInt(file, 100000 + output, 8);
+                writeOutputScript(file, seed++);
+            }
+            writeInt(file, 0, 4);
+        }
+
+        uint64_t end = file.tellp();
+        file.seekp(sizePosition);
+        writeInt(file, end - positions.back(), 4);
+        file.seekp(end);
+    }
+    return positions;
+}
+
+int main() {
+    if(!VtcBlockIndexer::AllocationCounter::enabled()) {
+        cerr << "Build with -DVTC_COUNT_ALLOCATIONS to count allocations" << endl;
+        return 1;
+    }
+
+    char dir[] = "/tmp/vtcbenchXXXXXX";
+    if(mkdtemp(dir) == NULL) {
+        cerr << "Failed to create a temporary directory: " << strerror(errno) << endl;
+        return 1;
+    }
+    const string fileName = "blk00000.dat";
+    vector<uint64_t> positions = writeBlockFile(string(dir) + "/" + fileName);
+
+    // Reads and solves the outputs of every block like the indexer does,
+    // without the database writes
+    VtcBlockIndexer::BlockReader blockReader(dir);
+    VtcBlockIndexer::ScriptSolver scriptSolver;
+    scriptSolver.testnet = false;
+    uint64_t readAllocations = 0;
+    uint64_t solveAllocations = 0;
+    size_t addresses = 0;
+    for(size_t height = 0; height < positions.size(); height++) {
+        uint64_t start = VtcBlockIndexer::AllocationCounter::count();
+        VtcBlockIndexer::Block block = blockReader.readBlock(fileName, positions.at(height), height, false, false);
+        uint64_t read = VtcBlockIndexer::AllocationCounter::count();
+        for(const VtcBlockIndexer::Transaction& tx : block.transactions) {
+            for(const VtcBlockIndexer::TransactionOutput& out : tx.outputs) {
+                addresses += scriptSolver.getAddressesFromScript(out.script).size();
+            }
+        }
+        uint64_t solved = VtcBlockIndexer::AllocationCounter::count();
+        readAllocations += read - start;
+        solveAllocations += solved - read;
+    }
+
+    unlink((string(dir) + "/" + fileName).c_str());
+    rmdir(dir);
+
+    cout << "Blocks: " << positions.size() << " of " << transactionsPerBlock << " transactions, " << addresses << " addresses solved" << endl;
+    cout << "Heap allocations per block reading: " << readAllocations / positions.size() << endl;
+    cout << "Heap allocations per block solving outputs: " << solveAllocations / positions.size() << endl;
+    return 0;
+}
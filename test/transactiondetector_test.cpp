@@ -0,0 +1,94 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "transactiondetector.h"
+#include "utility.h"
+#include <iostream>
+
+using namespace std;
+
+int failures = 0;
+
+void check(bool condition, const string& description) {
+    if(!condition) {
+        cerr << "FAIL: " << description << endl;
+        failures++;
+    }
+}
+
+VtcBlockIndexer::TransactionOutput output(uint64_t value, const string& scriptHex) {
+    VtcBlockIndexer::TransactionOutput out;
+    out.value = value;
+    out.script = VtcBlockIndexer::Utility::hexToBytes(scriptHex);
+    return out;
+}
+
+// Builds an identity transaction the way the identity service publishes
+// them: change, 100 satoshi to the person, the 'IDEN' marker and the payload
+VtcBlockIndexer::Transaction identityTransaction(const string& markerScriptHex) {
+    VtcBlockIndexer::Transaction tx;
+    tx.txHash = string(64, 'a');
+
+    VtcBlockIndexer::TransactionInput input;
+    input.txHash = string(64, 'b');
+    input.txoIndex = 0;
+    input.coinbase = false;
+    tx.inputs.push_back(input);
+
+    tx.outputs.push_back(output(5000, "76a914" + string(40, '1') + "88ac"));
+    tx.outputs.push_back(output(100, "76a914" + string(40, '2') + "88ac"));
+    tx.outputs.push_back(output(0, markerScriptHex));
+    tx.outputs.push_back(output(0, "6a0b68656c6c6f20776f726c64"));
+    return tx;
+}
+
+int main() {
+    VtcBlockIndexer::UtxoCache utxoCache(nullptr, 100);
+    utxoCache.add(string(64, 'b'), 0, "VfundingAddress", 10000);
+
+    vector<unique_ptr<VtcBlockIndexer::TransactionDetector>> detectors = VtcBlockIndexer::TransactionDetector::createDetectors(&utxoCache, nullptr);
+    VtcBlockIndexer::TransactionDetector* identity = nullptr;
+    for(unique_ptr<VtcBlockIndexer::TransactionDetector>& detector : detectors) {
+        if(detector->name().compare("ident") == 0) {
+            identity = detector.get();
+        }
+    }
+    check(identity != nullptr, "identity detector is created");
+    if(identity == nullptr) {
+        return 1;
+    }
+
+    // OP_RETURN OP_PUSHDATA(4) 'IDEN'
+    VtcBlockIndexer::DetectedTransaction match;
+    check(identity->detect(identityTransaction("6a044944454e"), match), "identity transaction is detected");
+    check(match.fromAddress.compare("VfundingAddress") == 0, "funding address is the from address");
+    check(!match.toAddress.empty(), "person address is the to address");
+    check(VtcBlockIndexer::Utility::hashToHex(match.script).compare("6a0b68656c6c6f20776f726c64") == 0, "payload is the script");
+
+    VtcBlockIndexer::DetectedTransaction other;
+    check(!identity->detect(identityTransaction("6a0449444e45"), other), "other marker is not detected");
+
+    if(failures > 0) {
+        cerr << failures << " check(s) failed" << endl;
+        return 1;
+    }
+    cout << "All checks passed" << endl;
+    return 0;
+}